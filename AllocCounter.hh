@@ -0,0 +1,64 @@
+#ifndef QCDAWARE_ALLOCCOUNTER_HH
+#define QCDAWARE_ALLOCCOUNTER_HH
+
+// Counts heap allocations made through the global operator new.
+//
+// This replaces the global allocation functions, so include it in
+// exactly one translation unit of an executable (the benchmark
+// driver), never in the analysis plugin itself.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace AllocCounter {
+    std::atomic<unsigned long> allocations(0);
+    std::atomic<unsigned long> bytes(0);
+
+    inline void* allocate(std::size_t n) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+        return std::malloc(n ? n : 1);
+    }
+}
+
+
+void* operator new(std::size_t n) {
+    void* p = AllocCounter::allocate(n);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t n) {
+    void* p = AllocCounter::allocate(n);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+    return AllocCounter::allocate(n);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+    return AllocCounter::allocate(n);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,96 @@
+// Checks EtaPhiGrid::forEachNear() against a brute-force search: every
+// point within the radius of a query must be visited, and none twice.
+// Part of `make check`; needs nothing but the standard library.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "EtaPhiGrid.hh"
+
+using namespace std;
+
+
+static double deltaR(double eta1, double phi1, double eta2, double phi2) {
+    double dphi = fabs(phi1 - phi2);
+    dphi = min(dphi, 2*M_PI - dphi);
+    return sqrt((eta1 - eta2)*(eta1 - eta2) + dphi*dphi);
+}
+
+
+struct Visits {
+    vector<unsigned int>* counts;
+    void operator()(unsigned int i) const {
+        (*counts)[i]++;
+    }
+};
+
+
+int main() {
+    mt19937 rng(1);
+    uniform_real_distribution<double> unit(0, 1);
+
+    // radii giving one, two, three and many phi cells.
+    const double radii[] = { 4.0, 2.5, 1.6, 0.4, 0.1 };
+
+    EtaPhiGrid grid;
+    vector<double> etas, phis;
+    vector<unsigned int> counts;
+
+    unsigned long nQueries = 0, nFailures = 0;
+    for (unsigned int trial = 0; trial < 2000; trial++) {
+        const double radius = radii[trial % 5];
+        const unsigned int n = trial % 50;
+
+        etas.clear();
+        phis.clear();
+        for (unsigned int i = 0; i < n; i++) {
+            // some points exactly on cell boundaries and at phi = 0.
+            if (i % 7 == 0) {
+                etas.push_back(radius*int(10*unit(rng) - 5));
+                phis.push_back(i % 14 ? 0 : 2*M_PI*int(8*unit(rng))/8);
+            } else {
+                etas.push_back(10*unit(rng) - 5);
+                phis.push_back(2*M_PI*unit(rng));
+            }
+        }
+
+        grid.build(etas, phis, radius);
+
+        for (unsigned int q = 0; q < 20; q++) {
+            // queries on points, near phi = 0 and 2 pi, and past the
+            // points' eta range.
+            double eta = 12*unit(rng) - 6;
+            double phi = 2*M_PI*unit(rng);
+            if (n && q % 4 == 0) {
+                eta = etas[q % n];
+                phi = phis[q % n];
+            } else if (q % 4 == 1) {
+                phi = q % 8 == 1 ? 1e-12 : 2*M_PI - 1e-12;
+            }
+
+            counts.assign(n, 0);
+            Visits visits = { &counts };
+            grid.forEachNear(eta, phi, visits);
+            nQueries++;
+
+            for (unsigned int i = 0; i < n; i++) {
+                const bool near = deltaR(eta, phi, etas[i], phis[i]) <= radius;
+                if (counts[i] > 1 || (near && !counts[i])) {
+                    if (nFailures++ < 10)
+                        printf("radius %g, query (%g, %g): point %u at (%g, %g) visited %u times\n",
+                                radius, eta, phi, i, etas[i], phis[i], counts[i]);
+                }
+            }
+        }
+    }
+
+    if (nFailures) {
+        printf("FAILED: %lu misses or repeats in %lu grid queries\n", nFailures, nQueries);
+        return 1;
+    }
+
+    printf("OK: %lu grid queries match a brute-force search\n", nQueries);
+    return 0;
+}
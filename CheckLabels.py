@@ -0,0 +1,116 @@
+from __future__ import print_function
+import optparse
+import sys
+
+import JetRecords
+
+
+# a golden file has one line per jet: event, rank and the PDG ID of
+# each label scheme, after a "# event rank <schemes>" line. Labels and
+# jet counts are compared, not momenta, which may differ in the last
+# bit between platforms.
+MAXREPORTED = 20
+
+
+def recordLabels(fname):
+    """the label scheme names and, per event, the label PDG IDs of its
+    jets in rank order, from a jet record file."""
+
+    _, _, schemes = JetRecords.readHeader(fname)
+    cols = JetRecords.readColumns(fname)
+
+    events = {}
+    for i in range(len(cols["event"])):
+        labels = tuple(int(cols[scheme + "Pid"][i]) for scheme in schemes)
+        events.setdefault(int(cols["event"][i]), []).append(labels)
+
+    return schemes, events
+
+
+def readGolden(fname):
+    with open(fname) as f:
+        header = f.readline().split()
+        if header[:3] != ["#", "event", "rank"]:
+            raise ValueError("%s is not a golden label file" % fname)
+
+        events = {}
+        for line in f:
+            fields = [int(x) for x in line.split()]
+            events.setdefault(fields[0], []).append(tuple(fields[2:]))
+
+    return header[3:], events
+
+
+def writeGolden(fname, schemes, events):
+    with open(fname, 'w') as f:
+        f.write("# event rank %s\n" % " ".join(schemes))
+        for event in sorted(events):
+            for rank, labels in enumerate(events[event]):
+                f.write("%d %d %s\n" % (event, rank, " ".join(map(str, labels))))
+
+
+def compare(schemes, events, golden):
+    """a list of the differences between events and golden."""
+
+    diffs = []
+    for event in sorted(set(events) | set(golden)):
+        jets = events.get(event, [])
+        expected = golden.get(event, [])
+        if len(jets) != len(expected):
+            diffs.append("event %d: %d jets, expected %d"
+                    % (event, len(jets), len(expected)))
+            continue
+
+        for rank, (labels, exp) in enumerate(zip(jets, expected)):
+            for scheme, pid, exppid in zip(schemes, labels, exp):
+                if pid != exppid:
+                    diffs.append("event %d jet %d: %s label %d, expected %d"
+                            % (event, rank, scheme, pid, exppid))
+
+    return diffs
+
+
+def main():
+    op = optparse.OptionParser(usage="%prog [--write] records.dat golden.txt")
+    op.add_option("--write", action="store_true", default=False,
+            help="write the records' labels to golden.txt instead of checking them")
+
+    opts, args = op.parse_args()
+    if len(args) != 2:
+        op.error("need a jet record file and a golden file")
+
+    schemes, events = recordLabels(args[0])
+
+    if opts.write:
+        writeGolden(args[1], schemes, events)
+        print("wrote the labels of %d jets in %d events to %s"
+                % (sum(map(len, events.values())), len(events), args[1]))
+        return 0
+
+    try:
+        goldenSchemes, golden = readGolden(args[1])
+    except IOError:
+        print("no golden labels in %s; make them on a trusted build with"
+                " `make golden` and commit them." % args[1])
+        return 1
+
+    if goldenSchemes != schemes:
+        print("label schemes %s, expected %s" % (schemes, goldenSchemes))
+        return 1
+
+    diffs = compare(schemes, events, golden)
+    for diff in diffs[:MAXREPORTED]:
+        print(diff)
+    if len(diffs) > MAXREPORTED:
+        print("... and %d more" % (len(diffs) - MAXREPORTED))
+
+    njets = sum(map(len, golden.values()))
+    if diffs:
+        print("FAILED: %d differences from %s" % (len(diffs), args[1]))
+        return 1
+
+    print("OK: %d jets in %d events match %s" % (njets, len(golden), args[1]))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
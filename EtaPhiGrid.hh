@@ -0,0 +1,108 @@
+#ifndef QCDAWARE_ETAPHIGRID_HH
+#define QCDAWARE_ETAPHIGRID_HH
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// A uniform (eta, phi) grid for finding the points near a direction
+// without looking at all of them.
+//
+// Cells are at least as wide as the search radius in both directions,
+// so every point within the radius of a query lies in the 3x3 block of
+// cells around it. The buffers keep their capacity between build()s.
+class EtaPhiGrid {
+    private:
+        double _etaMin;
+        double _etaCell;
+        double _phiCell;
+        int _nEta;
+        int _nPhi;
+
+        // point indices sorted by cell: cell c holds
+        // _points[_start[c]] to _points[_start[c+1]-1].
+        std::vector<unsigned int> _start;
+        std::vector<unsigned int> _points;
+        std::vector<unsigned int> _cellOf;
+        std::vector<unsigned int> _next;
+
+        int etaBin(double eta) const {
+            return int(std::floor((eta - _etaMin)/_etaCell));
+        }
+
+        int phiBin(double phi) const {
+            const int i = int(std::floor(phi/_phiCell)) % _nPhi;
+            return i < 0 ? i + _nPhi : i;
+        }
+
+    public:
+        EtaPhiGrid()
+            : _etaMin(0), _etaCell(1), _phiCell(2*M_PI), _nEta(0), _nPhi(1) { }
+
+        void build(const std::vector<double>& etas, const std::vector<double>& phis,
+                double radius) {
+
+            // a little wider than the radius, so that rounding can't
+            // put a point at exactly the radius two cells away.
+            const double width = radius*(1 + 1e-9);
+
+            _etaCell = width;
+            _nPhi = std::max(1, int(2*M_PI/width));
+            _phiCell = 2*M_PI/_nPhi;
+
+            const unsigned int n = etas.size();
+            _points.resize(n);
+            _cellOf.resize(n);
+
+            if (!n) {
+                _nEta = 0;
+                _start.assign(1, 0);
+                return;
+            }
+
+            _etaMin = *std::min_element(etas.begin(), etas.end());
+            const double etaMax = *std::max_element(etas.begin(), etas.end());
+            _nEta = etaBin(etaMax) + 1;
+
+            // counting sort of the points by cell
+            _start.assign(_nEta*_nPhi + 1, 0);
+            for (unsigned int i = 0; i < n; i++) {
+                _cellOf[i] = etaBin(etas[i])*_nPhi + phiBin(phis[i]);
+                _start[_cellOf[i] + 1]++;
+            }
+
+            for (unsigned int c = 1; c < _start.size(); c++)
+                _start[c] += _start[c-1];
+
+            _next.assign(_start.begin(), _start.end() - 1);
+            for (unsigned int i = 0; i < n; i++)
+                _points[_next[_cellOf[i]]++] = i;
+        }
+
+        // calls f(i) for every point i that may be within the radius
+        // of (eta, phi), in increasing order within each cell.
+        template <typename F>
+        void forEachNear(double eta, double phi, F f) const {
+            if (!_nEta)
+                return;
+
+            const int ie = etaBin(eta);
+            const int ip = phiBin(phi);
+
+            // with fewer than three phi cells, -1 and +1 may be the
+            // same cell, or the query's own.
+            static const int dphis[3] = { 0, 1, -1 };
+            const int nPhiNeighbours = std::min(_nPhi, 3);
+
+            for (int je = std::max(ie - 1, 0); je <= std::min(ie + 1, _nEta - 1); je++) {
+                for (int k = 0; k < nPhiNeighbours; k++) {
+                    const int jp = (ip + dphis[k] + _nPhi) % _nPhi;
+                    const unsigned int c = je*_nPhi + jp;
+                    for (unsigned int j = _start[c]; j < _start[c+1]; j++)
+                        f(_points[j]);
+                }
+            }
+        }
+};
+
+#endif
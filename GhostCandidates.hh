@@ -0,0 +1,149 @@
+#ifndef QCDAWARE_GHOSTCANDIDATES_HH
+#define QCDAWARE_GHOSTCANDIDATES_HH
+
+#include <limits>
+#include <vector>
+
+#include "fastjet/ClusterSequence.hh"
+
+#include "UserInfoParticle.hh"
+
+// The label candidates of one jet: its ghost constituents, unpacked
+// once into plain arrays so that the label selections are simple loops
+// over contiguous numbers.
+//
+// The visible particles, usually most of a jet, are dropped while
+// gathering. The buffers keep their capacity between gather()s.
+class GhostCandidates {
+    private:
+        std::vector<int> _tag;
+        std::vector<double> _pt;
+        std::vector<double> _dr;
+        std::vector<const UserInfoParticle*> _info;
+
+        // cluster history indices still to visit
+        std::vector<int> _stack;
+
+        void add(const fastjet::PseudoJet& pj) {
+            const UserInfoParticle* uip =
+                static_cast<const UserInfoParticle*>(pj.user_info_ptr());
+
+            if (uip->tag() == UserInfoParticle::VisibleParticle)
+                return;
+
+            const Rivet::Particle& part = uip->particle();
+            _tag.push_back(uip->tag());
+            _pt.push_back(part.pT());
+            _info.push_back(uip);
+        }
+
+    public:
+        void clear() {
+            _tag.clear();
+            _pt.clear();
+            _dr.clear();
+            _info.clear();
+        }
+
+        // the ghosts among the constituents of jet, in the order
+        // PseudoJet::constituents() would give them, read straight
+        // from the cluster history instead of copying the constituents.
+        void gather(const fastjet::PseudoJet& jet) {
+            clear();
+
+            const fastjet::ClusterSequence* cs = jet.associated_cluster_sequence();
+            if (!cs) {
+                const std::vector<fastjet::PseudoJet> constituents = jet.constituents();
+                for (unsigned int i = 0; i < constituents.size(); i++)
+                    add(constituents[i]);
+                return;
+            }
+
+            const std::vector<fastjet::ClusterSequence::history_element>& history = cs->history();
+            const std::vector<fastjet::PseudoJet>& jets = cs->jets();
+
+            _stack.assign(1, jet.cluster_hist_index());
+            while (!_stack.empty()) {
+                const int h = _stack.back();
+                _stack.pop_back();
+
+                const fastjet::ClusterSequence::history_element& step = history[h];
+                if (step.parent1 == fastjet::ClusterSequence::InexistentParent) {
+                    add(jets[step.jetp_index]);
+                    continue;
+                }
+
+                // parent1's constituents come first.
+                if (step.parent2 != fastjet::ClusterSequence::BeamJet)
+                    _stack.push_back(step.parent2);
+                _stack.push_back(step.parent1);
+            }
+        }
+
+        unsigned int size() const {
+            return _tag.size();
+        }
+
+        const UserInfoParticle& info(int i) const {
+            return *_info[i];
+        }
+
+        double dr(int i) const {
+            return _dr[i];
+        }
+
+        // the distance of every candidate to the jet axis, with
+        // Rivet's deltaR as the labelling always used, so that the
+        // maxDr cuts and ties come out the same to the last bit.
+        void computeDr(const Rivet::FourMomentum& jp4) {
+            const unsigned int n = size();
+            _dr.resize(n);
+
+            for (unsigned int i = 0; i < n; i++)
+                _dr[i] = Rivet::deltaR(jp4, _info[i]->particle());
+        }
+
+        // the nearest candidate with tag t, pT >= ptMin and dR <=
+        // maxDr, the first one on ties; -1 if there is none.
+        // call computeDr() first.
+        int nearest(UserInfoParticle::Tag t, double ptMin, double maxDr) const {
+            int best = -1;
+            double bestDr = std::numeric_limits<double>::infinity();
+
+            const unsigned int n = size();
+            for (unsigned int i = 0; i < n; i++) {
+                const bool better = _tag[i] == t && _pt[i] >= ptMin
+                    && _dr[i] <= maxDr && _dr[i] < bestDr;
+                best = better ? int(i) : best;
+                bestDr = better ? _dr[i] : bestDr;
+            }
+
+            return best;
+        }
+
+        // the highest-pT candidate with tag t, the first one on ties;
+        // -1 if there is none.
+        int hardest(UserInfoParticle::Tag t) const {
+            int best = -1;
+            double bestPt = 0;
+
+            const unsigned int n = size();
+            for (unsigned int i = 0; i < n; i++) {
+                const bool better = _tag[i] == t && _pt[i] > bestPt;
+                best = better ? int(i) : best;
+                bestPt = better ? _pt[i] : bestPt;
+            }
+
+            return best;
+        }
+
+        // append the input indices of the candidates with tag t.
+        void inputs(UserInfoParticle::Tag t, std::vector<int>& out) const {
+            const unsigned int n = size();
+            for (unsigned int i = 0; i < n; i++)
+                if (_tag[i] == t)
+                    out.push_back(_info[i]->input());
+        }
+};
+
+#endif
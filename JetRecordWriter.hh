@@ -0,0 +1,204 @@
+#ifndef QCDAWARE_JETRECORDWRITER_HH
+#define QCDAWARE_JETRECORDWRITER_HH
+
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Writes one fixed-size record per labelled jet to an append-only,
+// columnar binary file that JetRecords.py maps straight into numpy.
+//
+// Layout, in the byte order of the writing machine:
+//
+//   header, 128 bytes:
+//     char[8] "QCDJETS1", uint32 version, uint32 chunk capacity C,
+//     uint32 number of label schemes S, uint32 byteOrderMark,
+//     S label scheme names of 16 bytes each, zero padded.
+//
+//   then chunks, all the same size:
+//     uint64 number of records n <= C, then the columns, each with
+//     room for C entries:
+//       uint64 event, double weight, double px, py, pz, e, int32 rank,
+//       int32 pid[S][C], float pt[S][C], float dr[S][C]
+//
+// Chunks are written as they fill up and whenever flush() is called,
+// so any of them may be partly filled, its unused entries zero. Event
+// numbers only increase along the file. byteOrderMark is 0x01020304, so
+// that readers can tell which byte order the file was written in.
+class JetRecordWriter {
+    public:
+        static const unsigned int headerSize = 128;
+        static const unsigned int nameSize = 16;
+        static const uint32_t version = 1;
+        static const uint32_t byteOrderMark = 0x01020304;
+
+    private:
+        std::ofstream _out;
+        unsigned int _capacity;
+        unsigned int _nSchemes;
+        unsigned int _n;
+
+        std::vector<uint64_t> _event;
+        std::vector<double> _weight;
+        std::vector<double> _px;
+        std::vector<double> _py;
+        std::vector<double> _pz;
+        std::vector<double> _e;
+        std::vector<int32_t> _rank;
+        std::vector<int32_t> _pid;
+        std::vector<float> _pt;
+        std::vector<float> _dr;
+
+        template <typename T>
+        void writeColumn(std::vector<T>& col) {
+            _out.write(reinterpret_cast<const char*>(&col[0]), col.size()*sizeof(T));
+            col.assign(col.size(), T());
+        }
+
+        void writeChunk() {
+            const uint64_t n = _n;
+            _out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+
+            writeColumn(_event);
+            writeColumn(_weight);
+            writeColumn(_px);
+            writeColumn(_py);
+            writeColumn(_pz);
+            writeColumn(_e);
+            writeColumn(_rank);
+            writeColumn(_pid);
+            writeColumn(_pt);
+            writeColumn(_dr);
+
+            _out.flush();
+            _n = 0;
+        }
+
+        // keep the records of the events before firstEvent, the
+        // first one still to be written, that an earlier run with the
+        // same header wrote to path, and append after them. Leaves the
+        // file alone, and the writer closed, if it has a different
+        // header or a chunk with events on both sides of firstEvent.
+        void reopen(const std::string& path, const char* header, uint64_t firstEvent) {
+            std::ifstream in(path.c_str(), std::ios::binary);
+            char saved[headerSize];
+            if (!in.read(saved, headerSize) || memcmp(saved, header, headerSize))
+                return;
+
+            in.seekg(0, std::ios::end);
+            const uint64_t size = in.tellg();
+            const uint64_t chunkSize = sizeof(uint64_t)
+                + _capacity*(sizeof(uint64_t) + 5*sizeof(double) + sizeof(int32_t))
+                + _nSchemes*_capacity*(sizeof(int32_t) + 2*sizeof(float));
+
+            // drop the chunks of later events, and any incomplete one
+            // at the end.
+            uint64_t keep = headerSize;
+            for (; keep + chunkSize <= size; keep += chunkSize) {
+                uint64_t n;
+                in.seekg(keep);
+                in.read(reinterpret_cast<char*>(&n), sizeof(n));
+                in.read(reinterpret_cast<char*>(&_event[0]), _capacity*sizeof(uint64_t));
+                if (!in || n == 0 || n > _capacity)
+                    return;
+
+                if (_event[0] >= firstEvent)
+                    break;
+                if (_event[n-1] >= firstEvent)
+                    return;
+            }
+
+            _event.assign(_capacity, 0);
+            in.close();
+
+            if (truncate(path.c_str(), keep) != 0)
+                return;
+
+            _out.open(path.c_str(), std::ios::binary | std::ios::app);
+        }
+
+    public:
+        // with resumeEvents, keep the records of events 0 to
+        // resumeEvents-1 already in path, as reopen() does,
+        // instead of starting the file again.
+        JetRecordWriter(const std::string& path, const std::vector<std::string>& schemes,
+                unsigned int capacity=4096, uint64_t resumeEvents=0)
+            : _capacity(capacity), _nSchemes(schemes.size()), _n(0),
+            _event(capacity), _weight(capacity), _px(capacity), _py(capacity),
+            _pz(capacity), _e(capacity), _rank(capacity),
+            _pid(_nSchemes*capacity), _pt(_nSchemes*capacity), _dr(_nSchemes*capacity) {
+
+            char header[headerSize];
+            memset(header, 0, headerSize);
+
+            uint32_t fields[4] = { version, uint32_t(_capacity), uint32_t(_nSchemes),
+                byteOrderMark };
+            memcpy(header, "QCDJETS1", 8);
+            memcpy(header + 8, fields, sizeof(fields));
+
+            for (unsigned int i = 0; i < _nSchemes && 24 + (i+1)*nameSize <= headerSize; i++)
+                strncpy(header + 24 + i*nameSize, schemes[i].c_str(), nameSize-1);
+
+            if (resumeEvents) {
+                reopen(path, header, resumeEvents);
+                return;
+            }
+
+            _out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+            _out.write(header, headerSize);
+        }
+
+        ~JetRecordWriter() {
+            close();
+        }
+
+        bool good() const {
+            return _out.is_open() && _out.good();
+        }
+
+        // start a record; its labels are set with setLabel().
+        void add(uint64_t event, double weight, int rank,
+                double px, double py, double pz, double e) {
+            if (_n == _capacity)
+                writeChunk();
+
+            _event[_n] = event;
+            _weight[_n] = weight;
+            _rank[_n] = rank;
+            _px[_n] = px;
+            _py[_n] = py;
+            _pz[_n] = pz;
+            _e[_n] = e;
+            _n++;
+        }
+
+        // label scheme of the latest record.
+        void setLabel(unsigned int scheme, int pid, float pt, float dr) {
+            const unsigned int i = scheme*_capacity + _n - 1;
+            _pid[i] = pid;
+            _pt[i] = pt;
+            _dr[i] = dr;
+        }
+
+        // write out the records so far, e.g. at a checkpoint.
+        void flush() {
+            if (_out.is_open() && _n)
+                writeChunk();
+        }
+
+        // write out the last, partly filled chunk.
+        void close() {
+            if (!_out.is_open())
+                return;
+
+            if (_n)
+                writeChunk();
+
+            _out.close();
+        }
+};
+
+#endif
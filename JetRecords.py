@@ -0,0 +1,115 @@
+from __future__ import print_function
+import numpy as np
+import optparse
+import struct
+
+
+# see JetRecordWriter.hh for the layout.
+HEADERSIZE = 128
+NAMESIZE = 16
+VERSION = 1
+BYTEORDERMARK = 0x01020304
+
+
+def readHeader(fname):
+    """the byte order ("<" or ">"), chunk capacity and label scheme
+    names of a jet record file."""
+
+    with open(fname, 'rb') as f:
+        header = f.read(HEADERSIZE)
+
+    if header[:8] != b"QCDJETS1":
+        raise ValueError("%s is not a jet record file" % fname)
+
+    for order in "<>":
+        version, capacity, nschemes, mark = \
+                struct.unpack(order + "4I", header[8:24])
+        if mark == BYTEORDERMARK:
+            break
+    else:
+        raise ValueError("%s has an unknown byte order" % fname)
+
+    if version != VERSION:
+        raise ValueError("%s is a version %d jet record file; expected %d"
+                % (fname, version, VERSION))
+
+    schemes = [header[24+i*NAMESIZE:24+(i+1)*NAMESIZE].rstrip(b'\0').decode()
+            for i in range(nschemes)]
+
+    return order, capacity, schemes
+
+
+def chunkDtype(order, capacity, nschemes):
+    return np.dtype([
+        ("n", order + "u8"),
+        ("event", order + "u8", (capacity,)),
+        ("weight", order + "f8", (capacity,)),
+        ("px", order + "f8", (capacity,)),
+        ("py", order + "f8", (capacity,)),
+        ("pz", order + "f8", (capacity,)),
+        ("e", order + "f8", (capacity,)),
+        ("rank", order + "i4", (capacity,)),
+        ("pid", order + "i4", (nschemes, capacity)),
+        ("pt", order + "f4", (nschemes, capacity)),
+        ("dr", order + "f4", (nschemes, capacity))
+        ])
+
+
+def mapChunks(fname):
+    """the file's chunks as a memory-mapped structured array, and the
+    label scheme names."""
+
+    order, capacity, schemes = readHeader(fname)
+
+    chunks = np.memmap(fname, dtype=chunkDtype(order, capacity, len(schemes)),
+            mode='r', offset=HEADERSIZE)
+
+    return chunks, schemes
+
+
+def readColumns(fname):
+    """a dict of per-jet columns, with label columns named by scheme,
+    e.g. "AktPid", "AktPt", "AktDr"."""
+
+    chunks, schemes = mapChunks(fname)
+    ns = chunks["n"]
+
+    def column(name, i=None):
+        parts = [c[name][:n] if i is None else c[name][i,:n]
+                for c, n in zip(chunks, ns)]
+        return np.concatenate(parts) if parts else np.zeros(0)
+
+    cols = {}
+    for name in ["event", "weight", "px", "py", "pz", "e", "rank"]:
+        cols[name] = column(name)
+
+    cols["pt"] = np.hypot(cols["px"], cols["py"])
+
+    for i, scheme in enumerate(schemes):
+        cols[scheme + "Pid"] = column("pid", i)
+        cols[scheme + "Pt"] = column("pt", i)
+        cols[scheme + "Dr"] = column("dr", i)
+
+    return cols
+
+
+def main():
+    op = optparse.OptionParser(usage="%prog records.dat")
+    opts, args = op.parse_args()
+
+    _, _, schemes = readHeader(args[0])
+    cols = readColumns(args[0])
+
+    njets = len(cols["weight"])
+    nevts = len(np.unique(cols["event"]))
+    print("%d jets in %d events" % (njets, nevts))
+
+    for scheme in schemes:
+        labeled = cols[scheme + "Pid"] != 0
+        print("%-12s %6.2f%% labeled" %
+                (scheme, 100.0*labeled.sum()/max(njets, 1)))
+
+    return 0
+
+if __name__ == '__main__':
+    main()
@@ -1,76 +1,9 @@
 from __future__ import print_function
 import yoda
-import itertools 
-import os, optparse
+import optparse
 import re
 from sys import stdout
 
-binning = list(enumerate([
-    ("none", [0]),
-    ("$g$", [21]),
-    ("$q$", [-3, -2, -1, 1, 2, 3]),
-    ("$c$", [-4, 4]),
-    ("$b$", [-5, 5]),
-    ("$\\gamma$", [22]),
-    ("$e^-$", [11]),
-    ("$e^+$", [-11]),
-    ("$\\mu^-$", [13]),
-    ("$\\mu^+$", [-13]),
-    ("$\\tau$", [15])
-    ]))
-
-
-def histBinToMatrixBin(b):
-    mx = b.xMid
-    my = b.yMid
-    xbin = -1
-    ybin = -1
-    
-    for binNum, (l, pids) in binning:
-        for pid in pids:
-            if (xbin < 0) and (pid-0.5) < mx and mx < (pid+0.5):
-                xbin = binNum
-
-            if (ybin < 0) and (pid-0.5) < my and my < (pid+0.5):
-                ybin = binNum
-
-            continue
-
-            # we've already found both bin numbers...
-            if xbin >= 0 and ybin >= 0:
-                break
-
-        continue
-
-    return (xbin, ybin)
-
-
-def histToMatrix(hobj, nbins):
-    hMatrix = yoda.Histo2D(nbins, 0, nbins, nbins, 0, nbins,
-            hobj.path + "_matrix", "jet label matrix")
-
-    binningAnnotation = '\t'.join(map(
-            lambda (n, (lab, _)): "%02.2f\t%s" % ((n+0.5), lab),
-            binning[:nbins]))
-
-    hMatrix.setAnnotation("XCustomMajorTicks", binningAnnotation)
-    hMatrix.setAnnotation("YCustomMajorTicks", binningAnnotation)
-    hMatrix.setAnnotation("PlotTickLabels", "1")
-    hMatrix.setAnnotation("PlotXMajorTicks", "0")
-    hMatrix.setAnnotation("ZLabel", "arbitrary")
-    hMatrix.setAnnotation("XLabel", hobj.annotation("XLabel"))
-    hMatrix.setAnnotation("YLabel", hobj.annotation("YLabel"))
-    hMatrix.setAnnotation("ZCustomMajorTicks", "0.5\t$ $")
-
-
-    hobj.normalize(1.0)
-    for b in hobj.bins:
-        xbin, ybin = histBinToMatrixBin(b)
-        hMatrix.fill(xbin, ybin, b.sumW)
-        continue
-
-    return hMatrix
-
 
 def roundText(n):
     if n > 0.1:
@@ -119,46 +52,26 @@ def matrixToLatex(m):
 
 
 def main():
-    op = optparse.OptionParser()
-
-    ##add args to name plot so we have meaningful legends later
-    ##add axis labels by default
-
+    op = optparse.OptionParser(usage="%prog analysis.yoda matrices.tex")
 
     opts, args = op.parse_args()
-    name = os.path.splitext(args[0])
 
     aodict = yoda.core.read(args[0], True)
 
-    yfiledict = {}
-
-    jetcombos = ["%sLabVs%sLab" % x for x in itertools.combinations(["Akt", "Kt", "Reclustered", "MaxPt"], 2)]
-    jettypes = ["Inclusive", "Jet0", "Jet1", "Jet2", "Jet3"]
-
-    labels = ["%s_%s" % x for x in itertools.product(jettypes,
-        jetcombos)]
+    # the analysis books these as normalised flavour matrices.
+    label = re.compile("_[A-Za-z]+LabVs[A-Za-z]+Lab$")
 
-    label = re.compile("|".join(labels))
-
-    aos = []
     texs = []
-    for k, ao in aodict.iteritems():
-        m = label.search(k)
-        if m:
-            lab = m.group(0)
-        else:
+    for k, m in sorted(aodict.items()):
+        if not label.search(k):
             continue
 
-        print("found label " + lab); stdout.flush()
+        print("found label matrix " + k); stdout.flush()
 
-        m = histToMatrix(ao, 6)
-        aos.append(m)
         texs.append(m.path + "\n" + matrixToLatex(m))
         continue
 
-    yoda.write(aos, args[1])
-
-    open(args[2], 'w').write("\n\n".join(texs))
+    open(args[1], 'w').write("\n\n".join(texs))
 
     return 0
 
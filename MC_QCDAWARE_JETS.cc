@@ -1,4 +1,20 @@
 // -*- C++ -*-
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "fastjet/config.h"
 #include "fastjet/JetDefinition.hh"
 #include "fastjet/ClusterSequence.hh"
 #include "fastjet/contrib/QCDAwarePlugin.hh"
@@ -11,7 +27,21 @@
 #include "Rivet/Projections/TauFinder.hh"
 #include "Rivet/Tools/Logging.hh"
 
+#include "HepMC/IO_GenEvent.h"
+
+#include "YODA/ReaderYODA.h"
+#include "YODA/WriterYODA.h"
+
+#include <sys/resource.h>
+
+#include "EtaPhiGrid.hh"
+#include "GhostCandidates.hh"
+#include "JetRecordWriter.hh"
+#include "ParticleGraphCache.hh"
+#include "SkimFile.hh"
+#include "StageTimer.hh"
 #include "UserInfoParticle.hh"
+#include "WorkerPool.hh"
 
 
 using namespace std;
@@ -20,28 +50,395 @@ using namespace fastjet::contrib::QCDAwarePlugin;
 
 namespace Rivet {
 
+    /// Jet labelling schemes, in the order of MC_QCDAWARE_JETS::labels.
+    enum LabelScheme {
+        AktLabel = 0,
+        KtLabel,
+        CALabel,
+        MaxPtLabel,
+        ReclusteredLabel,
+        NLabelSchemes
+    };
+
+    /// Label flavour categories, in the order of MC_QCDAWARE_JETS::flavors.
+    enum LabelFlavor {
+        UnlabeledFlavor = 0,
+        GluonFlavor,
+        LightFlavor,
+        CharmFlavor,
+        BottomFlavor,
+        PhotonFlavor,
+        ElectronFlavor,
+        MuonFlavor,
+        TauFlavor,
+        NLabelFlavors
+    };
+
+    /// Jet slots histograms are filled for, in the order of
+    /// MC_QCDAWARE_JETS::leadlabs.
+    enum JetSlot {
+        InclusiveSlot = 0,
+        Jet0Slot,
+        Jet1Slot,
+        Jet2Slot,
+        Jet3Slot,
+        NJetSlots
+    };
+
+
+    /// A particle jet and its label under each scheme. Each label is
+    /// kept with its dR to the jet; unlabelled schemes hold a zero
+    /// particle with PID 0.
     class LabeledJet {
         private:
-            map<string, Particle> _labelMap;
-            const PseudoJet& _pjet;
+            PseudoJet _pjet;
+            FourMomentum _p4;
+
+            Particle _labels[NLabelSchemes];
+            double _dr[NLabelSchemes];
+            bool _labeled[NLabelSchemes];
 
         public:
-            LabeledJet(const PseudoJet& pj) : _pjet(pj) { }
+            LabeledJet(const PseudoJet& pj)
+                : _pjet(pj), _p4(Rivet::momentum(pj)) {
+
+                const Particle unlabeled(0, FourMomentum(0, 0, 0, 0));
+                const double dr = deltaR(_p4, unlabeled);
+                for (unsigned int i = 0; i < NLabelSchemes; i++) {
+                    _labels[i] = unlabeled;
+                    _dr[i] = dr;
+                    _labeled[i] = false;
+                }
+            }
+
+            const Particle& operator[] (LabelScheme lab) const {
+                return _labels[lab];
+            }
 
-            Particle& operator[] (const string& lab) {
-                map<string, Particle>::const_iterator p = _labelMap.find(lab);
+            double labelDr(LabelScheme lab) const {
+                return _dr[lab];
+            }
 
-                // automatically make particle if doesn't already
-                // exist.
-                if (p == _labelMap.end())
-                    _labelMap[lab] = Particle(0, FourMomentum(0, 0, 0, 0));
+            bool isLabeled(LabelScheme lab) const {
+                return _labeled[lab];
+            }
 
-                return _labelMap[lab];
+            // dr must be deltaR(momentum(), p).
+            void setLabel(LabelScheme lab, const Particle& p, double dr) {
+                _labels[lab] = p;
+                _dr[lab] = dr;
+                _labeled[lab] = true;
             }
 
-            const PseudoJet pseudojet() {
+            const PseudoJet& pseudojet() const {
                 return _pjet;
             }
+
+            const FourMomentum& momentum() const {
+                return _p4;
+            }
+    };
+
+
+    /// Handles to the observables booked for one (jet slot, flavour,
+    /// label scheme) combination.
+    struct LabelHistos {
+        Histo1DPtr pt;
+        Histo1DPtr dpt;
+        Histo1DPtr dr;
+        Profile1DPtr meanDrVsPt;
+        Profile1DPtr meanDptVsDr;
+        Profile1DPtr meanDptVsPt;
+        Histo2DPtr drDpt;
+    };
+
+
+    /// Everything the labelling needs from one event, copied out of the
+    /// projections so that it can be processed after analyze() returns.
+    struct EventInputs {
+        double weight;
+        // the weight of each weight stream, the nominal one first.
+        vector<double> weights;
+
+        vector<Particle> partonJetInputs;
+        vector<Particle> visibleParticles;
+        vector<Particle> genPartons;
+
+        // the pile-up overlay point, or -1 without overlay; with one,
+        // the event's own visible particles are the first
+        // nEventVisible, the overlay's come after them.
+        int pileupPoint;
+        unsigned int nEventVisible;
+
+        // with early reject, each clustering group's jets from the
+        // visible particles alone (just the momenta); empty otherwise.
+        vector<vector<PseudoJet> > visibleJets;
+
+        void clear() {
+            weight = 0;
+            weights.clear();
+            partonJetInputs.clear();
+            visibleParticles.clear();
+            genPartons.clear();
+            pileupPoint = -1;
+            nEventVisible = 0;
+            for (unsigned int i = 0; i < visibleJets.size(); i++)
+                visibleJets[i].clear();
+        }
+
+        EventInputs() {
+            clear();
+        }
+    };
+
+
+    /// One overlay multiplicity of the pile-up stress mode, and what
+    /// labelling events with it cost.
+    struct PileupPoint {
+        unsigned int nOverlay;
+
+        unsigned long nEvents;
+        double visibleSum;
+        double labelSeconds;
+        double maxLabelSeconds;
+
+        // process peak resident set size by the end of the point
+        long peakRssKb;
+
+        PileupPoint(unsigned int n)
+            : nOverlay(n), nEvents(0), visibleSum(0), labelSeconds(0),
+            maxLabelSeconds(0), peakRssKb(0) { }
+    };
+
+
+    /// Per-event quantities recorded by the instrumentation, in the
+    /// order of MC_QCDAWARE_JETS::counterNames. Ghosts and particle
+    /// clustering inputs are summed over jet radii when sweeping.
+    enum EventCounter {
+        PartonInputsCounter = 0,
+        VisibleParticlesCounter,
+        ParticleInputsCounter,
+        AktGhostsCounter,
+        KtGhostsCounter,
+        CAGhostsCounter,
+        FinalPartonGhostsCounter,
+        PartonGhostsCounter,
+        JetsCounter,
+        NEventCounters
+    };
+
+
+    /// One event's instrumentation counts.
+    struct EventCounts {
+        unsigned int counts[NEventCounters];
+
+        // input sizes of the Reclustered labels that needed an actual
+        // reclustering.
+        vector<unsigned int> reclusterInputs;
+
+        void clear() {
+            for (unsigned int i = 0; i < NEventCounters; i++)
+                counts[i] = 0;
+            reclusterInputs.clear();
+        }
+
+        EventCounts() {
+            clear();
+        }
+    };
+
+
+    /// One event queued for labelling on the event pool.
+    struct EventTask {
+        EventInputs inputs;
+        // one list per LabelConfig
+        vector<vector<LabeledJet> > labjets;
+        EventCounts counts;
+        double labelSeconds;
+
+        // set under MC_QCDAWARE_JETS::eventMutex
+        bool done;
+        exception_ptr error;
+
+        EventTask() : done(false) { }
+    };
+
+
+    /// How MaxPt labels are found.
+    enum MaxPtMode {
+        // ghost every GenEvent parton and photon into the particle
+        // clustering (exact).
+        MaxPtGhost = 0,
+        // associate them with the clustered jets afterwards.
+        MaxPtMatch,
+        // label by ghosting, but also match and count disagreements.
+        MaxPtValidate
+    };
+
+
+    /// How the Akt, Kt and CA labels are found.
+    enum PartonJetMode {
+        // ghost the parton jets into the particle clustering (exact).
+        PartonJetGhost = 0,
+        // match them to the clustered jets by dR.
+        PartonJetMatch,
+        // label by ghosting, but also match and compare.
+        PartonJetValidate
+    };
+
+    /// The label schemes given by QCD-aware parton jets, which are the
+    /// first NPartonJetSchemes LabelSchemes.
+    const unsigned int NPartonJetSchemes = MaxPtLabel;
+
+    /// Jets found without ghosts pass the early-reject check from this
+    /// fraction below the pT cut, far more than the ghosts can move them.
+    const double EarlyRejectMargin = 0.01;
+
+
+    /// Scratch space for one jet's Reclustered label.
+    struct ReclusterScratch {
+        // indices of the jet's ghost-associated final partons
+        vector<int> partons;
+        vector<int> ktJetsTouched;
+        vector<PseudoJet> inputs;
+
+        // the jet's ghosts, for the other labels
+        GhostCandidates ghosts;
+
+        void clear() {
+            partons.clear();
+            ktJetsTouched.clear();
+            inputs.clear();
+            ghosts.clear();
+        }
+    };
+
+
+    /// Per-event scratch space. The buffers keep their capacity and the
+    /// user-info pool its entries from one event to the next.
+    struct EventWorkspace {
+        UserInfoPool userInfos;
+
+        vector<PseudoJet> partonPJs;
+        vector<PseudoJet> particlePJs;
+        // one reclustering buffer per particle jet, so that jets can
+        // be labelled concurrently.
+        vector<ReclusterScratch> reclusterScratch;
+
+        // the final QCD-aware kt parton jets (without a pT cut) and,
+        // for each entry of partonPJs, the index of the one it ended
+        // up in. The Reclustered labels reuse these when they can.
+        vector<PseudoJet> ktFinalJets;
+        vector<unsigned int> ktFinalJetSizes;
+        vector<int> ktJetOfParton;
+
+        // buffers for matched MaxPt labels.
+        vector<PseudoJet> allJets;
+        vector<Particle> maxPtMatches;
+
+        // the parton jets of each parton-jet scheme, as labels, and
+        // their (eta, phi) index for dR matching.
+        vector<Particle> partonJets[NPartonJetSchemes];
+        vector<double> partonJetEtas;
+        vector<double> partonJetPhis;
+        EtaPhiGrid partonJetGrids[NPartonJetSchemes];
+        vector<Particle> partonJetMatches;
+
+        // PartonJetValidate bookkeeping per parton-jet scheme, summed
+        // over the whole run: jets compared, identical labels, and
+        // (ghost flavour, matched flavour) counts.
+        unsigned long partonJetChecked[NPartonJetSchemes];
+        unsigned long partonJetAgreements[NPartonJetSchemes];
+        unsigned long partonJetMigrations[NPartonJetSchemes][NLabelFlavors][NLabelFlavors];
+
+        // time spent labelling, if QCDAWARE_TIMING is set.
+        StageTimer timer;
+
+        // the last event's counts, if QCDAWARE_INSTRUMENT is set.
+        EventCounts counts;
+
+        // how long the last event took to label, with pile-up overlay.
+        double labelSeconds;
+
+        // MaxPtValidate bookkeeping, summed over the whole run.
+        unsigned long maxPtChecked;
+        unsigned long maxPtDisagreements;
+        unsigned long maxPtFlavorDisagreements;
+
+        EventWorkspace()
+            : labelSeconds(0), maxPtChecked(0), maxPtDisagreements(0),
+            maxPtFlavorDisagreements(0) {
+
+            for (unsigned int i = 0; i < NPartonJetSchemes; i++) {
+                partonJetChecked[i] = 0;
+                partonJetAgreements[i] = 0;
+                for (unsigned int j = 0; j < NLabelFlavors; j++)
+                    for (unsigned int k = 0; k < NLabelFlavors; k++)
+                        partonJetMigrations[i][j][k] = 0;
+            }
+        }
+
+        // drop the previous event's PseudoJets before recycling
+        // their user info.
+        void reset() {
+            partonPJs.clear();
+            resetGroup();
+            userInfos.reset();
+        }
+
+        // drop what one jet radius's clusterings left behind.
+        void resetGroup() {
+            particlePJs.clear();
+            ktFinalJets.clear();
+            ktFinalJetSizes.clear();
+            ktJetOfParton.clear();
+        }
+    };
+
+
+    /// One set of jet-labelling parameters, with the histograms it
+    /// fills. The nominal configuration is always run; QCDAWARE_SWEEP
+    /// adds more.
+    struct LabelConfig {
+        // particle (and parton) jet radius
+        double jetR;
+        // furthest a parton jet label may be from its jet
+        double maxLabelDr;
+        double partonJetPtMin;
+        double jetPtMin;
+
+        // index into MC_QCDAWARE_JETS::groups
+        unsigned int group;
+
+        // prepended to the names of the histograms; empty for the
+        // nominal configuration.
+        string prefix;
+
+        vector<LabelHistos> labelHistoTable;
+        vector<Histo2DPtr> labelComparisonTable;
+
+        LabelConfig(double r, double dr, double partonptmin, double ptmin)
+            : jetR(r), maxLabelDr(dr), partonJetPtMin(partonptmin),
+            jetPtMin(ptmin), group(0) { }
+    };
+
+
+    /// The configurations sharing a jet radius, and so the QCD-aware
+    /// and particle clusterings of each event.
+    struct ClusteringGroup {
+        double jetR;
+
+        QCDAwarePlugin *qcdawareakt;
+        QCDAwarePlugin *qcdawarekt;
+        QCDAwarePlugin *qcdawareca;
+
+        // indices into MC_QCDAWARE_JETS::configs
+        vector<unsigned int> configs;
+
+        // the loosest cuts of those configurations
+        double partonJetPtMin;
+        double jetPtMin;
+        double maxLabelDr;
     };
 
 
@@ -51,17 +448,161 @@ namespace Rivet {
             vector<string> flavors;
             vector<string> labels;
             vector<string> labelsTex;
+            vector<string> flavorsTex;
             vector<string> leadlabs;
-
-            double maxLabelDr;
-
-            QCDAwarePlugin *qcdawareakt;
-            QCDAwarePlugin *qcdawarekt;
-            QCDAwarePlugin *qcdawareca;
-
-            std::map<string, Histo1DPtr> histos1D;
-            std::map<string, Profile1DPtr> profiles1D;
-            std::map<string, Histo2DPtr> histos2D;
+            vector<string> counterNames;
+            vector<double> counterMax;
+
+            MaxPtMode maxPtMode;
+            PartonJetMode partonJetMode;
+
+            // QCDAWARE_EARLY_REJECT (on by default): cluster the visible
+            // particles without ghosts first, and only gather and
+            // cluster the partons for events with a jet of some radius.
+            // QCDAWARE_GHOST_REGION=1 also only ghosts in partons and
+            // parton jets within 2R of those jets.
+            bool earlyReject;
+            bool ghostRegion;
+            vector<PseudoJet> visiblePJs;
+            unsigned long nEarlyChecked;
+            unsigned long nEarlyRejected;
+
+            // QCDAWARE_TIMING: time each stage. Gathering and filling
+            // are timed here, labelling in each workspace.
+            bool timing;
+            StageTimer analyzeTimer;
+
+            // QCDAWARE_INSTRUMENT: histogram per-event multiplicities,
+            // unscaled, and summarise them at the end. Compiled out
+            // with -DQCDAWARE_NO_INSTRUMENTATION.
+            bool instrument;
+            vector<Histo1DPtr> counterHistos;
+            Histo1DPtr reclusterInputsHisto;
+            vector<unsigned long> counterSums;
+            vector<unsigned long> counterMaxima;
+            unsigned long nCountedEvents;
+            unsigned long nReclusters;
+            unsigned long reclusterInputSum;
+            unsigned long reclusterInputMax;
+
+            // QCDAWARE_PILEUP_FILE=minbias.hepmc: overlay the visible
+            // particles of QCDAWARE_PILEUP_N min-bias events on every
+            // event. QCDAWARE_PILEUP_N may be a comma-separated list of
+            // multiplicities, each used for QCDAWARE_PILEUP_EVENTS
+            // consecutive events (the last one for the rest), to see
+            // how the labelling scales. The timings only go to the log,
+            // so that the output stays reproducible.
+            vector<vector<Particle> > pileupEvents;
+            vector<PileupPoint> pileupPoints;
+            unsigned long pileupBlock;
+            unsigned long nPileupEvents;
+            unsigned long nextPileupEvent;
+
+            // QCDAWARE_SKIM=path: write each event's labelling inputs
+            // there, without any pile-up overlay. QCDAWARE_SKIM_REPLAY=path
+            // takes the inputs from such a file instead of the event,
+            // one record per event and starting again, with a warning,
+            // at the end, and overlays pile-up on them as usual; the
+            // events only supply the weights, as in qcdaware-bench's
+            // replay of a skim. NULL otherwise.
+            QCDAwareSkim::Writer *skimWriter;
+            QCDAwareSkim::Reader *skimReader;
+            unsigned long nSkimEvents;
+            // times the replay ran out of records and started again.
+            unsigned long nSkimWraps;
+
+            // QCDAWARE_JET_RECORDS=path: also write a record of every
+            // nominal-configuration jet there; NULL otherwise.
+            JetRecordWriter *jetRecords;
+            unsigned long nRecordedEvents;
+
+            // the nominal configuration first. Each has dense
+            // histogram tables, booked in init() and indexed by
+            // labelHistoIndex() and labelComparisonIndex() so that
+            // the per-jet fill path never builds or looks up names.
+            vector<LabelConfig> configs;
+            vector<ClusteringGroup> groups;
+
+            // QCDAWARE_WEIGHTS="i,j,...": also fill every histogram with
+            // the event weights of those indices, in copies named
+            // Weight<i>_..., each normalised to its own sum of weights.
+            // The first stream is always the nominal weight, which
+            // keeps the usual names. The label tables hold each
+            // stream's histograms in turn.
+            vector<unsigned int> weightStreams;
+            vector<string> streamPrefixes;
+            // the sums of weights of the streams after the nominal one;
+            // the nominal's is Rivet's.
+            vector<CounterPtr> streamSumOfWeights;
+            bool warnedMissingWeights;
+
+            // QCDAWARE_LAZY_BOOKING: leave the tables empty and book
+            // each histogram set on its first fill.
+            bool lazyBooking;
+
+            // QCDAWARE_SHARD_PREFIX: write each flavour/label category
+            // to its own <prefix>_<category>.yoda instead of the main
+            // output, as SplitJetFiles.py would.
+            string shardPrefix;
+
+            // QCDAWARE_RAW: leave everything unnormalised and record
+            // the sum of weights and cross section instead, so that
+            // the outputs of several runs can be added up first.
+            bool raw;
+            CounterPtr rawSumOfWeights;
+            CounterPtr rawCrossSection;
+
+            // QCDAWARE_CHECKPOINT=path: snapshot the unnormalised
+            // analysis objects there every QCDAWARE_CHECKPOINT_EVENTS
+            // events or QCDAWARE_CHECKPOINT_SECONDS seconds, whichever
+            // comes first. Snapshots are copied on the commit path and
+            // written to path.tmp and renamed on a background thread.
+            // With QCDAWARE_RESUME=1, a restarted job adds the snapshot
+            // back in and skips the events it covers, so it must be
+            // given the same events again, e.g. with the same seed.
+            // The QCDAWARE_JET_RECORDS and QCDAWARE_SKIM files are
+            // flushed with every snapshot, and on resuming cut back to
+            // the events it covers and appended to; if they cannot be,
+            // they are left alone and not written.
+            string checkpointFile;
+            unsigned long checkpointEvents;
+            double checkpointSeconds;
+            unsigned long nSinceCheckpoint;
+            chrono::steady_clock::time_point lastCheckpoint;
+            // the events committed so far and their sum of weights
+            YODA::Counter checkpointState;
+            thread checkpointThread;
+            atomic<bool> checkpointWriting;
+            atomic<bool> checkpointFailed;
+            unsigned long nResumeEvents;
+            unsigned long nSkipped;
+            double skippedSumW;
+
+            // decay-graph queries for the event being gathered.
+            ParticleGraphCache graph;
+
+            EventInputs serialInputs;
+            EventWorkspace serialWorkspace;
+            vector<vector<LabeledJet> > serialLabjets;
+
+            // optional pool for running the independent parton
+            // clusterings and per-jet labelling of one event
+            // concurrently; NULL when running serially.
+            WorkerPool *labelPool;
+
+            // optional pool for labelling several events at once; NULL
+            // when running serially. Events are queued in a ring of
+            // eventTasks and committed to the histograms strictly in
+            // the order they arrived, so the output does not depend on
+            // the number of threads.
+            WorkerPool *eventPool;
+            vector<EventTask> eventTasks;
+            vector<EventWorkspace> eventWorkspaces;
+            vector<EventWorkspace*> freeWorkspaces;
+            unsigned long nSubmitted;
+            unsigned long nCommitted;
+            mutex eventMutex;
+            condition_variable eventDone;
 
 
         public:
@@ -71,7 +612,42 @@ namespace Rivet {
             // this is really, really ugly.
             MC_QCDAWARE_JETS()
                 : Analysis("MC_QCDAWARE_JETS"),
-                maxLabelDr(0.2) {
+                maxPtMode(MaxPtGhost),
+                partonJetMode(PartonJetGhost),
+                earlyReject(true),
+                ghostRegion(false),
+                nEarlyChecked(0),
+                nEarlyRejected(0),
+                timing(false),
+                instrument(false),
+                nCountedEvents(0),
+                nReclusters(0),
+                reclusterInputSum(0),
+                reclusterInputMax(0),
+                pileupBlock(0),
+                nPileupEvents(0),
+                nextPileupEvent(0),
+                skimWriter(NULL),
+                skimReader(NULL),
+                nSkimEvents(0),
+                nSkimWraps(0),
+                jetRecords(NULL),
+                nRecordedEvents(0),
+                warnedMissingWeights(false),
+                lazyBooking(false),
+                raw(false),
+                checkpointEvents(0),
+                checkpointSeconds(0),
+                nSinceCheckpoint(0),
+                checkpointWriting(false),
+                checkpointFailed(false),
+                nResumeEvents(0),
+                nSkipped(0),
+                skippedSumW(0),
+                labelPool(NULL),
+                eventPool(NULL),
+                nSubmitted(0),
+                nCommitted(0) {
 
                     flavors.push_back("Unlabeled");
                     flavors.push_back("Gluon");
@@ -83,6 +659,16 @@ namespace Rivet {
                     flavors.push_back("Muon");
                     flavors.push_back("Tau");
 
+                    flavorsTex.push_back("none");
+                    flavorsTex.push_back("$g$");
+                    flavorsTex.push_back("$q$");
+                    flavorsTex.push_back("$c$");
+                    flavorsTex.push_back("$b$");
+                    flavorsTex.push_back("$\\gamma$");
+                    flavorsTex.push_back("$e$");
+                    flavorsTex.push_back("$\\mu$");
+                    flavorsTex.push_back("$\\tau$");
+
                     labels.push_back("Akt");
                     labels.push_back("Kt");
                     labels.push_back("CA");
@@ -101,10 +687,49 @@ namespace Rivet {
                     leadlabs.push_back("Jet2");
                     leadlabs.push_back("Jet3");
 
+                    counterNames.push_back("PartonInputs");
+                    counterNames.push_back("VisibleParticles");
+                    counterNames.push_back("ParticleInputs");
+                    counterNames.push_back("AktGhosts");
+                    counterNames.push_back("KtGhosts");
+                    counterNames.push_back("CAGhosts");
+                    counterNames.push_back("FinalPartonGhosts");
+                    counterNames.push_back("PartonGhosts");
+                    counterNames.push_back("Jets");
+
+                    // histogram ranges
+                    counterMax.push_back(500);
+                    counterMax.push_back(2000);
+                    counterMax.push_back(5000);
+                    counterMax.push_back(100);
+                    counterMax.push_back(100);
+                    counterMax.push_back(100);
+                    counterMax.push_back(500);
+                    counterMax.push_back(2000);
+                    counterMax.push_back(50);
+
                     return;
                 }
 
 
+            ~MC_QCDAWARE_JETS() {
+                if (checkpointThread.joinable())
+                    checkpointThread.join();
+
+                delete eventPool;
+                delete labelPool;
+                delete jetRecords;
+                delete skimWriter;
+                delete skimReader;
+
+                foreach (const ClusteringGroup& group, groups) {
+                    delete group.qcdawareakt;
+                    delete group.qcdawarekt;
+                    delete group.qcdawareca;
+                }
+            }
+
+
             void init() {
 
                 FinalPartons fps;
@@ -122,26 +747,170 @@ namespace Rivet {
                 TauFinder taufs(TauFinder::ANY);
                 addProjection(taufs, "Taus");
 
-                DistanceMeasure *aktdm = new AntiKtMeasure(0.4);
-                DistanceMeasure *ktdm = new KtMeasure(0.4);
-                DistanceMeasure *cadm = new CAMeasure(0.4);
+                // the nominal configuration, then any from
+                // QCDAWARE_SWEEP.
+                configs.push_back(LabelConfig(0.4, 0.2, 5*GeV, 25*GeV));
+                addSweepConfigs(envString("QCDAWARE_SWEEP", ""));
+
+                // one set of clusterings per distinct jet radius.
+                for (unsigned int icfg = 0; icfg < configs.size(); icfg++) {
+                    LabelConfig& cfg = configs[icfg];
+
+                    unsigned int igroup = 0;
+                    while (igroup < groups.size() && groups[igroup].jetR != cfg.jetR)
+                        igroup++;
+
+                    if (igroup == groups.size()) {
+                        ClusteringGroup group;
+                        group.jetR = cfg.jetR;
+                        group.qcdawareakt = new QCDAwarePlugin(new AntiKtMeasure(cfg.jetR));
+                        group.qcdawarekt = new QCDAwarePlugin(new KtMeasure(cfg.jetR));
+                        group.qcdawareca = new QCDAwarePlugin(new CAMeasure(cfg.jetR));
+                        group.partonJetPtMin = cfg.partonJetPtMin;
+                        group.jetPtMin = cfg.jetPtMin;
+                        group.maxLabelDr = cfg.maxLabelDr;
+                        groups.push_back(group);
+                    }
+
+                    ClusteringGroup& group = groups[igroup];
+                    group.configs.push_back(icfg);
+                    group.partonJetPtMin = min(group.partonJetPtMin, cfg.partonJetPtMin);
+                    group.jetPtMin = min(group.jetPtMin, cfg.jetPtMin);
+                    group.maxLabelDr = max(group.maxLabelDr, cfg.maxLabelDr);
+                    cfg.group = igroup;
+                }
+
+                // QCDAWARE_MAXPT=match finds MaxPt labels by
+                // associating partons with jets after clustering rather
+                // than ghosting them all in; QCDAWARE_MAXPT=validate
+                // keeps the ghost labels but reports how often the
+                // two disagree.
+                const string maxPtOption = envString("QCDAWARE_MAXPT", "ghost");
+                if (maxPtOption == "match")
+                    maxPtMode = MaxPtMatch;
+                else if (maxPtOption == "validate")
+                    maxPtMode = MaxPtValidate;
+                else if (maxPtOption != "ghost")
+                    MSG_WARNING("unknown QCDAWARE_MAXPT option " << maxPtOption
+                            << "; using ghost association.");
+
+                earlyReject = envOption("QCDAWARE_EARLY_REJECT", 1) > 0;
+                ghostRegion = envOption("QCDAWARE_GHOST_REGION", 0) > 0;
+                if (ghostRegion && !earlyReject) {
+                    MSG_WARNING("QCDAWARE_GHOST_REGION needs QCDAWARE_EARLY_REJECT; ignoring it.");
+                    ghostRegion = false;
+                }
+
+                timing = envOption("QCDAWARE_TIMING", 0) > 0;
+
+                if (envOption("QCDAWARE_INSTRUMENT", 0) > 0) {
+#ifdef QCDAWARE_NO_INSTRUMENTATION
+                    MSG_WARNING("built with QCDAWARE_NO_INSTRUMENTATION; "
+                            "ignoring QCDAWARE_INSTRUMENT.");
+#else
+                    // stage times are part of the instrumentation.
+                    instrument = true;
+                    timing = true;
+#endif
+                }
+
+                // QCDAWARE_PARTONJET_LABELS=match gives each jet the
+                // nearest parton jet within the label dR instead of
+                // ghosting the parton jets in; =validate keeps the
+                // ghost labels but reports how the two compare.
+                const string partonJetOption = envString("QCDAWARE_PARTONJET_LABELS", "ghost");
+                if (partonJetOption == "match")
+                    partonJetMode = PartonJetMatch;
+                else if (partonJetOption == "validate")
+                    partonJetMode = PartonJetValidate;
+                else if (partonJetOption != "ghost")
+                    MSG_WARNING("unknown QCDAWARE_PARTONJET_LABELS option " << partonJetOption
+                            << "; using ghost association.");
+
+                // QCDAWARE_EVENT_THREADS=N labels up to N+1 events at
+                // a time on worker threads; QCDAWARE_LABEL_THREADS=N
+                // instead spreads the three parton clusterings and the
+                // per-jet labelling of each single event over N extra
+                // threads.
+                int nEventThreads = envOption("QCDAWARE_EVENT_THREADS", 0);
+                int nLabelThreads = envOption("QCDAWARE_LABEL_THREADS", 0);
+                if (nEventThreads > 0 || nLabelThreads > 0) {
+#if defined(FASTJET_HAVE_LIMITED_THREAD_SAFETY) || defined(FASTJET_HAVE_THREAD_SAFETY)
+                    // print the banner now rather than racing for it.
+                    ClusterSequence::print_banner();
+
+                    if (nEventThreads > 0) {
+                        if (nLabelThreads > 0)
+                            MSG_WARNING("QCDAWARE_EVENT_THREADS is set; ignoring QCDAWARE_LABEL_THREADS.");
+
+                        // finalize() waits on the pool from this
+                        // thread too, hence the extra workspace.
+                        eventWorkspaces.resize(nEventThreads+1);
+                        for (unsigned int i = 0; i < eventWorkspaces.size(); i++)
+                            freeWorkspaces.push_back(&eventWorkspaces[i]);
+
+                        eventTasks.resize(4*nEventThreads);
+                        eventPool = new WorkerPool(nEventThreads);
+                        MSG_INFO("labelling events on " << nEventThreads << " threads");
+                    } else {
+                        labelPool = new WorkerPool(nLabelThreads);
+                        MSG_INFO("labelling each event with " << nLabelThreads << " extra threads");
+                    }
+#else
+                    MSG_WARNING("QCDAWARE_EVENT_THREADS and QCDAWARE_LABEL_THREADS need a "
+                            "thread-safe FastJet build (--enable-limited-thread-safety); "
+                            "labelling serially.");
+#endif
+                }
+
 
-                qcdawareakt = new QCDAwarePlugin(aktdm);
-                qcdawarekt = new QCDAwarePlugin(ktdm);
-                qcdawareca = new QCDAwarePlugin(cadm);
+                lazyBooking = envOption("QCDAWARE_LAZY_BOOKING", 0) > 0;
+                shardPrefix = envString("QCDAWARE_SHARD_PREFIX", "");
 
+                raw = envOption("QCDAWARE_RAW", 0) > 0;
+                if (raw) {
+                    rawSumOfWeights = bookCounter("RawSumOfWeights");
+                    rawCrossSection = bookCounter("RawCrossSection");
+                }
 
-                foreach (const string& flav, flavors)
-                    foreach (const string& lab, labels)
-                    foreach (const string& leadlab, leadlabs)
-                    bookLabelHistos(leadlab + "_" + flav + "_" + lab);
+                initWeightStreams(envString("QCDAWARE_WEIGHTS", ""));
+
+                foreach (LabelConfig& cfg, configs)
+                    bookLabelConfig(cfg);
+
+                if (instrumenting())
+                    bookCounters();
+
+                const string pileupFile = envString("QCDAWARE_PILEUP_FILE", "");
+                if (!pileupFile.empty())
+                    initPileup(pileupFile);
+
+                // first, so that a resumed run's record files keep the
+                // checkpointed events.
+                checkpointFile = envString("QCDAWARE_CHECKPOINT", "");
+                if (!checkpointFile.empty())
+                    initCheckpoint();
+
+                const string jetRecordFile = envString("QCDAWARE_JET_RECORDS", "");
+                if (!jetRecordFile.empty()) {
+                    jetRecords = new JetRecordWriter(jetRecordFile, labels, 4096, nResumeEvents);
+                    if (jetRecords->good()) {
+                        MSG_INFO("writing jet records to " << jetRecordFile);
+                    } else if (nResumeEvents) {
+                        MSG_ERROR(jetRecordFile << " does not hold the records of the "
+                                << nResumeEvents << " checkpointed events; leaving it alone"
+                                << " and not writing jet records.");
+                        delete jetRecords;
+                        jetRecords = NULL;
+                    } else {
+                        MSG_WARNING("could not open " << jetRecordFile
+                                << "; not writing jet records.");
+                        delete jetRecords;
+                        jetRecords = NULL;
+                    }
+                }
 
-                for (unsigned int i = 0; i < labels.size(); i++)
-                    for (unsigned int j = i+1; j < labels.size(); j++)
-                        foreach (const string& leadlab, leadlabs)
-                            bookLabelComparison(leadlab,
-                                    labels[i], labelsTex[i],
-                                    labels[j], labelsTex[j]);
+                initSkim();
 
                 return;
             }
@@ -149,7 +918,200 @@ namespace Rivet {
 
             /// Perform the per-event analysis
             void analyze(const Event& event) {
-                const double weight = event.weight();
+
+                // the handler still counts these events' weights, as
+                // it did the first time.
+                if (nSkipped < nResumeEvents) {
+                    skippedSumW += event.weight();
+                    if (++nSkipped == nResumeEvents)
+                        checkResumedWeights();
+                    return;
+                }
+
+                if (!eventPool) {
+                    gatherInputs(event, serialInputs);
+
+                    labelEvent(serialInputs, serialWorkspace, serialLabjets);
+                    fillEvent(serialLabjets, serialInputs.weights);
+                    if (instrumenting())
+                        fillCounters(serialWorkspace.counts);
+                    if (serialInputs.pileupPoint >= 0)
+                        fillPileup(serialInputs, serialWorkspace.labelSeconds);
+                    if (!checkpointFile.empty())
+                        checkpointEvent(serialInputs.weight);
+
+                    return;
+                }
+
+                // reuse the oldest slot in the ring once its event has
+                // been committed.
+                EventTask& task = eventTasks[nSubmitted % eventTasks.size()];
+                if (nSubmitted >= eventTasks.size())
+                    commitEvents(nSubmitted - eventTasks.size() + 1);
+
+                gatherInputs(event, task.inputs);
+                task.done = false;
+
+                eventPool->submit([this, &task] { labelEventTask(task); });
+                nSubmitted++;
+
+                // commit whatever has already finished.
+                commitFinishedEvents();
+
+                return;
+            }
+
+
+            /// Normalise histograms etc., after the run
+            void finalize() {
+
+                if (eventPool) {
+                    eventPool->wait();
+                    commitEvents(nSubmitted);
+                }
+
+                if (checkpointThread.joinable())
+                    checkpointThread.join();
+
+                if (maxPtMode == MaxPtValidate) {
+                    unsigned long nChecked = serialWorkspace.maxPtChecked;
+                    unsigned long nDisagree = serialWorkspace.maxPtDisagreements;
+                    unsigned long nFlavDisagree = serialWorkspace.maxPtFlavorDisagreements;
+                    foreach (const EventWorkspace& w, eventWorkspaces) {
+                        nChecked += w.maxPtChecked;
+                        nDisagree += w.maxPtDisagreements;
+                        nFlavDisagree += w.maxPtFlavorDisagreements;
+                    }
+
+                    MSG_INFO("MaxPt matching vs. ghost association: " << nChecked
+                            << " jets checked, " << nDisagree << " different labels ("
+                            << nFlavDisagree << " in a different flavour category).");
+                }
+
+
+                if (partonJetMode == PartonJetValidate)
+                    reportPartonJetMatching();
+
+                if (jetRecords)
+                    jetRecords->close();
+
+                if (skimWriter) {
+                    skimWriter->close();
+                    MSG_INFO("wrote the inputs of " << nSkimEvents << " events to the skim.");
+                }
+
+                if (skimReader) {
+                    MSG_INFO("replayed " << nSkimEvents << " events from the skim.");
+                    if (nSkimWraps)
+                        MSG_WARNING("the skim ran out and was started again " << nSkimWraps
+                                << " times; its records were labelled more than once.");
+                }
+
+                if (!pileupPoints.empty())
+                    reportPileup();
+
+                if (earlyReject)
+                    MSG_INFO("early reject: " << nEarlyRejected << " of " << nEarlyChecked
+                            << " events had no visible jets and no parton-level work.");
+
+                if (instrumenting())
+                    reportCounters();
+
+                if (timing)
+                    reportTiming();
+
+                // the snapshot's events are all in the histograms, but
+                // Rivet's sum of weights only has those skipped so far.
+                if (nSkipped < nResumeEvents) {
+                    MSG_ERROR("the run ended after skipping " << nSkipped << " of the "
+                            << nResumeEvents << " events checkpointed in " << checkpointFile
+                            << "; the sum of weights does not match the histograms,"
+                            << " so they are left unnormalised.");
+                } else if (raw) {
+                    // left for mc/merge_shards.py to add up and
+                    // normalise.
+                    rawSumOfWeights->fill(sumOfWeights());
+                    rawCrossSection->fill(crossSection());
+                } else {
+                    normalizeLabelHistos();
+                }
+
+                if (!shardPrefix.empty())
+                    writeLabelShards();
+
+            }
+
+
+        private:
+
+            void normalizeLabelHistos() {
+                const unsigned int nHistos = NJetSlots*NLabelFlavors*NLabelSchemes;
+
+                foreach (const LabelConfig& cfg, configs) {
+                    for (unsigned int i = 0; i < cfg.labelHistoTable.size(); i++) {
+                        const LabelHistos& h = cfg.labelHistoTable[i];
+
+                        // never filled, with lazy booking.
+                        if (!h.pt)
+                            continue;
+
+                        // normalize to 1/fb
+                        const double norm = 1000*crossSection()/streamSumW(i/nHistos);
+
+                        h.pt->scaleW(norm); // norm to cross section
+                        h.dpt->scaleW(norm);
+                        h.dr->scaleW(norm);
+                        h.meanDrVsPt->scaleW(norm);
+                        h.meanDptVsDr->scaleW(norm);
+                        h.meanDptVsPt->scaleW(norm);
+                        h.drDpt->scaleW(norm);
+                    }
+
+                    // migration matrices are fractions of all jets.
+                    foreach (const Histo2DPtr& h, cfg.labelComparisonTable)
+                        if (h && h->sumW() != 0)
+                            h->normalize(1.0);
+                }
+            }
+
+
+            // copy everything the labelling needs out of the event.
+            void gatherInputs(const Event& event, EventInputs& in) {
+                StageTimer::Scope timeIt(timing ? &analyzeTimer : NULL,
+                        StageTimer::Projections);
+
+                in.clear();
+                in.weight = event.weight();
+                gatherWeights(event, in);
+
+                if (skimReader) {
+                    readSkimEvent(in);
+                    return;
+                }
+
+                // particle jet inputs first, to see whether there are
+                // any jets at all.
+                const Particles& visibleParts =
+                    applyProjection<VisibleFinalState>(event, "VisibleFinalState").particles();
+
+                in.visibleParticles.assign(visibleParts.begin(), visibleParts.end());
+
+                if (!pileupPoints.empty())
+                    overlayPileup(in);
+
+                if (earlyReject) {
+                    nEarlyChecked++;
+                    if (!findVisibleJets(in)) {
+                        nEarlyRejected++;
+
+                        // a skim keeps every event's inputs, for
+                        // replays with other jet radii.
+                        if (!skimWriter)
+                            return;
+                    }
+                }
+
+                graph.build(event.genEvent());
 
                 // first get all final partons
                 const Particles& finalPartons =
@@ -161,8 +1123,8 @@ namespace Rivet {
                 const Particles& taus =
                     applyProjection<TauFinder>(event, "Taus").taus();
 
-                // first get the qcd-aware parton jets
-                vector<Particle> partonJetInputs;
+                // first get the qcd-aware parton jet inputs
+                vector<Particle>& partonJetInputs = in.partonJetInputs;
 
                 // loop over final partons
                 foreach (const Particle& part, finalPartons) {
@@ -175,7 +1137,7 @@ namespace Rivet {
                 // electrons, muons, and photons
                 foreach (const Particle& part, lepsgammas) {
                     // deal with tau decay products later.
-                    if (part.fromDecay())
+                    if (graph.fromDecay(part))
                         continue;
 
                     if (part.abseta() > 7.0)
@@ -187,34 +1149,25 @@ namespace Rivet {
                 // taus
                 foreach (const Particle& tau, taus) {
                     // reject taus from hadron decays and tau chains
-                    if (tau.fromDecay())
+                    if (graph.fromDecay(tau))
                         continue;
 
-                    bool hadtau = false;
-
                     // TODO
                     // this shouldn't be necessary...
-                    foreach (const Particle& p, tau.stableDescendants()) {
-
-                        if (tau.abseta() > 7.0)
-                            continue;
-
-                        if (p.isHadron()) {
-                            partonJetInputs.push_back(tau);
-                            hadtau = true;
-                            break;
-                        }
-                    }
+                    const bool hadtau =
+                        tau.abseta() <= 7.0 && graph.isHadronicTau(tau);
 
                     // break out of loop if we already labeled this as
                     // a hadronic tau.
-                    if (hadtau)
+                    if (hadtau) {
+                        partonJetInputs.push_back(tau);
                         break;
+                    }
 
                     // this isn't a hadronic tau.
                     // all stable descendants of leptonic taus should
                     // be included except neutrinos.
-                    foreach (const Particle& part, tau.stableDescendants()) {
+                    foreach (const Particle& part, graph.stableDescendants(tau)) {
                         if (part.isNeutrino())
                             continue;
 
@@ -225,323 +1178,1712 @@ namespace Rivet {
                     }
                 }
 
+                // ALL partons and photons for max-pt labeling
+                foreach (const GenParticle* gp, graph.particles()) {
+                    // check the PDG ID before building a Particle.
+                    const int pid = gp->pdg_id();
+                    if (!(PID::isParton(pid) || pid == PID::PHOTON))
+                        continue;
 
-                // make parton jet input pseudojets
-                vector<PseudoJet> partonPJs;
-                foreach (const Particle& part, partonJetInputs) {
-                    PseudoJet partPJ = part.pseudojet();
-                    // user_info points to particle.
-                    partPJ.set_user_info(new UserInfoParticle(part, "Parton"));
+                    Particle part(gp);
 
-                    // user_index used for flavor-aware clustering.
-                    partPJ.set_user_index(part.pid());
+                    // cut out anything that isn't a photon or parton and any high-eta (including incoming) particles
+                    if (!(isParton(part) || isPhoton(part)) || part.abseta() > 7.0)
+                        continue;
 
-                    partonPJs.push_back(partPJ);
+                    in.genPartons.push_back(part);
                 }
 
-                ClusterSequence qcdawareaktcs(partonPJs, qcdawareakt);
-                ClusterSequence qcdawarektcs(partonPJs, qcdawarekt);
-                ClusterSequence qcdawarecacs(partonPJs, qcdawareca);
+                if (skimWriter)
+                    writeSkimEvent(event, in);
 
-                const vector<PseudoJet> aktPartonJets =
-                    sorted_by_pt(qcdawareaktcs.inclusive_jets(5*GeV));
+                return;
+            }
 
-                const vector<PseudoJet> ktPartonJets =
-                    sorted_by_pt(qcdawarektcs.inclusive_jets(5*GeV));
 
-                const vector<PseudoJet> caPartonJets =
-                    sorted_by_pt(qcdawarecacs.inclusive_jets(5*GeV));
+            void initSkim() {
+                const string skimFile = envString("QCDAWARE_SKIM", "");
+                const string replayFile = envString("QCDAWARE_SKIM_REPLAY", "");
+
+                if (!replayFile.empty()) {
+                    skimReader = new QCDAwareSkim::Reader(replayFile);
+                    if (skimReader->good()) {
+                        MSG_INFO("replaying event inputs from " << replayFile);
+
+                        // the checkpointed events had the first records.
+                        QCDAwareSkim::Record record;
+                        for (unsigned long i = 0; i < nResumeEvents; i++) {
+                            if (!skimReader->next(record)) {
+                                rewindSkim();
+                                if (!skimReader->next(record))
+                                    break;
+                            }
+                            skimReader->skipParticles();
+                        }
+                    } else if (skimReader->isSkim()) {
+                        MSG_WARNING(replayFile << " is a skim of another version; using the events.");
+                        delete skimReader;
+                        skimReader = NULL;
+                    } else {
+                        MSG_WARNING(replayFile << " is not a skim; using the events.");
+                        delete skimReader;
+                        skimReader = NULL;
+                    }
+                }
 
-                // now particle jets
-                const Particles& visibleParts =
-                    applyProjection<VisibleFinalState>(event, "VisibleFinalState").particles();
+                if (skimFile.empty())
+                    return;
 
-                // constituents for particle jets
-                vector<PseudoJet> particlePJs;
-                foreach (const Particle& p, visibleParts) {
-                    PseudoJet pj = p.pseudojet();
-                    pj.set_user_info(new UserInfoParticle(p, "Particle"));
-                    particlePJs.push_back(pj);
+                if (skimReader) {
+                    MSG_WARNING("replaying a skim; not writing another to " << skimFile);
+                    return;
                 }
 
-                // ghost association of parton jets to particle jets
-                foreach (const PseudoJet& aktPJ, aktPartonJets) {
-                    particlePJs.push_back(
-                            ghost(Particle(aktPJ.user_index(), momentum(aktPJ)),
-                                "GAAktPartonJet", aktPJ.user_index()));
+                skimWriter = new QCDAwareSkim::Writer(skimFile, nResumeEvents);
+                if (skimWriter->good()) {
+                    MSG_INFO("writing event inputs to " << skimFile);
+                } else if (nResumeEvents) {
+                    MSG_ERROR(skimFile << " does not hold the inputs of the "
+                            << nResumeEvents << " checkpointed events; leaving it alone"
+                            << " and not writing a skim.");
+                    delete skimWriter;
+                    skimWriter = NULL;
+                } else {
+                    MSG_WARNING("could not open " << skimFile << "; not writing a skim.");
+                    delete skimWriter;
+                    skimWriter = NULL;
                 }
+            }
 
-                foreach (const PseudoJet& ktPJ, ktPartonJets) {
-                    particlePJs.push_back(
-                            ghost(Particle(ktPJ.user_index(), momentum(ktPJ)),
-                                "GAKtPartonJet", ktPJ.user_index()));
-                }
 
-                foreach (const PseudoJet& caPJ, caPartonJets) {
-                    particlePJs.push_back(
-                            ghost(Particle(caPJ.user_index(), momentum(caPJ)),
-                                "GACAPartonJet", caPJ.user_index()));
+            void writeSkimEvent(const Event& event, const EventInputs& in) {
+                double xs = 0, xsErr = 0;
+#ifdef HEPMC_HAS_CROSS_SECTION
+                const HepMC::GenCrossSection* gxs = event.genEvent()->cross_section();
+                if (gxs) {
+                    xs = gxs->cross_section();
+                    xsErr = gxs->cross_section_error();
                 }
+#endif
 
-                // ghost association of final partons to particle jets
-                foreach (const Particle& part, partonJetInputs)
-                    particlePJs.push_back(ghost(part, "GAFinalParton", part.pid()));
+                // without the pile-up overlay, which a replay adds
+                // again if asked to.
+                const size_t nVisible = in.pileupPoint >= 0 ?
+                    in.nEventVisible : in.visibleParticles.size();
 
-                // ghost association of ALL partons to particle jets
-                // for max-pt labeling
-                foreach (const GenParticle* gp, Rivet::particles(event.genEvent())) {
-                    Particle part(gp);
+                skimWriter->write(in.weight, xs, xsErr,
+                        in.partonJetInputs, in.visibleParticles, in.genPartons, nVisible);
+                nSkimEvents++;
+            }
 
-                    // cut out anything that isn't a photon or parton and any high-eta (including incoming) particles
-                    if (!(isParton(part) || isPhoton(part)) || part.abseta() > 7.0)
-                        continue;
 
-                    particlePJs.push_back(ghost(part, "GAParton", part.pid()));
-                }
+            void rewindSkim() {
+                if (!nSkimWraps++)
+                    MSG_WARNING("more events than skim records; replaying the skim"
+                            << " from the start, with the new events' weights.");
+                skimReader->rewind();
+            }
 
-                ClusterSequence akt04cs(particlePJs, JetDefinition(antikt_algorithm, 0.4));
 
-                const vector<PseudoJet> aktJets = sorted_by_pt(akt04cs.inclusive_jets(25*GeV));
+            // the next skimmed event's inputs in place of the
+            // projections'. The weight stays the event's.
+            void readSkimEvent(EventInputs& in) {
+                QCDAwareSkim::Record record;
+                if (!skimReader->next(record)) {
+                    rewindSkim();
+                    if (!skimReader->next(record)) {
+                        MSG_WARNING("no events in the skim; labelling nothing.");
+                        return;
+                    }
+                }
 
-                unsigned int iJet = 0;
-                foreach (const PseudoJet& j, aktJets) {
-                    LabeledJet labjet(j);
-                    fillJetLabels(labjet);
+                if (!skimReader->readParticles(in.partonJetInputs,
+                            in.visibleParticles, in.genPartons)) {
+                    MSG_WARNING("truncated skim record; labelling nothing.");
+                    in.partonJetInputs.clear();
+                    in.visibleParticles.clear();
+                    in.genPartons.clear();
+                    return;
+                }
 
-                    fillLabelHistos("Inclusive", labjet, weight);
+                nSkimEvents++;
 
-                    switch (iJet) {
-                        case 0:
-                            fillLabelHistos("Jet0", labjet, weight);
-                            break;
-                        case 1:
-                            fillLabelHistos("Jet1", labjet, weight);
-                            break;
-                        case 2:
-                            fillLabelHistos("Jet2", labjet, weight);
-                            break;
-                        case 3:
-                            fillLabelHistos("Jet3", labjet, weight);
-                            break;
-                    }
+                if (!pileupPoints.empty())
+                    overlayPileup(in);
 
-                    iJet++;
+                if (earlyReject) {
+                    nEarlyChecked++;
+                    if (!findVisibleJets(in))
+                        nEarlyRejected++;
                 }
-
-                return;
             }
 
 
-            /// Normalise histograms etc., after the run
-            void finalize() {
+            // ghost-free anti-kt jets of each radius, a little below the
+            // group's pT cut; false if there are none at all.
+            // Ghosts barely move the jets, so an event without these
+            // has no jets once they are added either.
+            bool findVisibleJets(EventInputs& in) {
+                in.visibleJets.resize(groups.size());
+
+                // no jet can be harder than all the particles together.
+                double sumPt = 0;
+                foreach (const Particle& p, in.visibleParticles)
+                    sumPt += p.pT();
+
+                visiblePJs.clear();
+                bool found = false;
+                for (unsigned int igroup = 0; igroup < groups.size(); igroup++) {
+                    const ClusteringGroup& group = groups[igroup];
+                    const double ptmin = (1 - EarlyRejectMargin)*group.jetPtMin;
+                    if (sumPt < ptmin)
+                        continue;
 
-                // normalize to 1/fb
-                double norm = 1000*crossSection()/sumOfWeights();
-                for (map< string, Histo1DPtr>::iterator p = histos1D.begin(); p != histos1D.end(); ++p)
-                    p->second->scaleW(norm); // norm to cross section
+                    if (visiblePJs.empty())
+                        foreach (const Particle& p, in.visibleParticles)
+                            visiblePJs.push_back(p.pseudojet());
 
-                for (map< string, Profile1DPtr>::iterator p = profiles1D.begin(); p != profiles1D.end(); ++p)
-                    p->second->scaleW(norm); // norm to cross section
+                    ClusterSequence cs(visiblePJs, JetDefinition(antikt_algorithm, group.jetR));
+                    foreach (const PseudoJet& jet, cs.inclusive_jets(ptmin))
+                        in.visibleJets[igroup].push_back(
+                                PseudoJet(jet.px(), jet.py(), jet.pz(), jet.E()));
 
-                for (map< string, Histo2DPtr>::iterator p = histos2D.begin(); p != histos2D.end(); ++p)
-                    p->second->scaleW(norm); // norm to cross section
+                    found = found || !in.visibleJets[igroup].empty();
+                }
 
+                return found;
             }
 
 
-        private:
+            // whether a ghost at (rap, phi) could end up in one of the
+            // given jets. A ghost joins a jet within R of one of its
+            // hard constituents, which are themselves within R of the
+            // axis, so maxDr = 2R.
+            static bool nearJets(double rap, double phi,
+                    const vector<PseudoJet>& axes, double maxDr) {
+                foreach (const PseudoJet& axis, axes) {
+                    const double drap = rap - axis.rap();
+                    double dphi = fabs(phi - axis.phi());
+                    dphi = min(dphi, 2*M_PI - dphi);
+                    if (drap*drap + dphi*dphi < maxDr*maxDr)
+                        return true;
+                }
 
-            void bookLabelHistos(const string& basename) {
+                return false;
+            }
 
-                MSG_DEBUG(string("booking label histograms: ") + basename);
 
-                histos1D[basename + "_Pt"] =
-                    bookHisto1D(basename + "_Pt", 50, 0, 100*GeV, "$p_T$",
-                            "$p_T$ / GeV", "entries");
+            // cluster and label one event's jets, for every
+            // configuration. Touches nothing but the inputs, the
+            // workspace and labjets, so events can be labelled
+            // concurrently given separate workspaces.
+            void labelEvent(const EventInputs& in, EventWorkspace& ws,
+                    vector<vector<LabeledJet> >& labjets) const {
 
-                histos1D[basename + "_Dpt"] =
-                    bookHisto1D(basename + "_Dpt", 50, -1, 1, "$p_T$ resolution",
-                            "$p_T$ resolution", "entries");
+                const chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-                histos1D[basename + "_Dr"] =
-                    bookHisto1D(basename + "_Dr", 50, 0, 1,
-                            "$\\Delta R$", "$\\Delta R$", "entries");
+                ws.reset();
+                labjets.resize(configs.size());
 
-                profiles1D[basename + "_MeanDrVsPt"] =
-                    bookProfile1D(basename + "_MeanDrVsPt", 50, 0, 100*GeV,
-                            "mean $\\Delta R$ vs $p_T$", "$p_T$ / GeV", "$\\Delta R$");
+                StageTimer::Scope timeInputs(timing ? &ws.timer : NULL,
+                        StageTimer::PartonClustering);
 
-                profiles1D[basename + "_MeanDptVsDr"] =
-                    bookProfile1D(basename + "_MeanDptVsDr", 50, 0, 1,
-                            "mean $p_T$ resolution vs $\\Delta R$", "$\\Delta R$", "$p_T$ resolution");
+                // make parton jet input pseudojets
+                // no user_info: the QCD-aware plugin only needs the
+                // flavour, which goes in user_index.
+                vector<PseudoJet>& partonPJs = ws.partonPJs;
+                foreach (const Particle& part, in.partonJetInputs) {
+                    PseudoJet partPJ = part.pseudojet();
 
-                profiles1D[basename + "_MeanDptVsPt"] =
-                    bookProfile1D(basename + "_MeanDptVsPt", 50, 0, 100*GeV,
-                            "mean $p_T$ resolution vs $p_T$", "$p_T$ / GeV", "$p_T$ resolution");
+                    // user_index used for flavor-aware clustering.
+                    partPJ.set_user_index(part.pid());
 
-                histos2D[basename + "_DrDpt"] = bookHisto2D(basename + "_DrDpt",
-                        50, 0, 1, 50, -1, 1,
-                        "$\\Delta R$ vs $p_T$ resolution",
-                        "\\Delta R", "$p_T$ resolution", "entries");
+                    partonPJs.push_back(partPJ);
+                }
 
-                return;
-            }
+                timeInputs.stop();
 
+                if (instrumenting()) {
+                    ws.counts.clear();
+                    ws.counts.counts[PartonInputsCounter] = in.partonJetInputs.size();
+                    ws.counts.counts[VisibleParticlesCounter] = in.visibleParticles.size();
+                }
 
-            // jet cannot be const because of default Particle return.
-            void fillLabelHistos(const string& prefix, LabeledJet& labjet, double weight) {
+                for (unsigned int igroup = 0; igroup < groups.size(); igroup++)
+                    labelGroup(in, igroup, ws, labjets);
 
-                double pt = labjet.pseudojet().pt();
-                foreach (const string& lab, labels) {
-                    const Particle& labelpart = labjet[lab];
-                    double dpt = 1 - labelpart.pt()/pt;
-                    double dr = deltaR(momentum(labjet.pseudojet()), labelpart);
+                if (in.pileupPoint >= 0)
+                    ws.labelSeconds = chrono::duration<double>(
+                            chrono::steady_clock::now() - start).count();
 
-                    const string basename = prefix + "_" +
-                        pidToLabel(labelpart.pid()) + "_" +
-                        lab;
+                return;
+            }
 
-                    MSG_DEBUG(string("filling label histogram: ") + basename);
 
+            // run the clusterings for one jet radius and label the
+            // jets of every configuration that uses it.
+            void labelGroup(const EventInputs& in, unsigned int igroup,
+                    EventWorkspace& ws, vector<vector<LabeledJet> >& labjets) const {
 
-                    histos1D[basename + "_Pt"]->fill(pt, weight);
-                    histos1D[basename + "_Dpt"]->fill(dpt, weight);
-                    histos1D[basename + "_Dr"]->fill(dr, weight);
-                    profiles1D[basename + "_MeanDrVsPt"]->fill(pt, dr, weight);
-                    profiles1D[basename + "_MeanDptVsDr"]->fill(dr, dpt, weight);
-                    profiles1D[basename + "_MeanDptVsPt"]->fill(pt, dpt, weight);
-                    histos2D[basename + "_DrDpt"]->fill(dr, dpt, weight);
-                }
+                const ClusteringGroup& group = groups[igroup];
 
-                for (unsigned int i = 0; i < labels.size(); i++) {
-                    for (unsigned int j = i+1; j < labels.size(); j++) {
-                        const string basename = prefix + "_" + labels[i] + "LabVs" +
-                            labels[j] + "Lab";
-                        histos2D[basename]->fill(labjet[labels[i]].pid(), labjet[labels[j]].pid(), weight);
+                // early reject found no jets of this radius.
+                if (!in.visibleJets.empty() && in.visibleJets[igroup].empty()) {
+                    foreach (unsigned int icfg, group.configs)
+                        labjets[icfg].clear();
+                    return;
+                }
+
+                // with QCDAWARE_GHOST_REGION, where ghosts can matter.
+                const vector<PseudoJet>* region =
+                    ghostRegion && !in.visibleJets.empty() ? &in.visibleJets[igroup] : NULL;
+                const double regionDr = 2*group.jetR;
+
+                ws.resetGroup();
+                StageTimer* timer = timing ? &ws.timer : NULL;
+
+                StageTimer::Scope timePartons(timer, StageTimer::PartonClustering);
+
+                const vector<PseudoJet>& partonPJs = ws.partonPJs;
+                const double partonJetPtMin = group.partonJetPtMin;
+
+                vector<PseudoJet> aktPartonJets;
+                vector<PseudoJet> ktPartonJets;
+                vector<PseudoJet> caPartonJets;
+
+                if (labelPool) {
+                    labelPool->submit([&] {
+                            clusterPartonJets(partonPJs, group.qcdawareakt,
+                                partonJetPtMin, aktPartonJets); });
+                    labelPool->submit([&] {
+                            clusterKtPartonJets(partonPJs, group.qcdawarekt,
+                                partonJetPtMin, ktPartonJets, ws); });
+                    labelPool->submit([&] {
+                            clusterPartonJets(partonPJs, group.qcdawareca,
+                                partonJetPtMin, caPartonJets); });
+                    labelPool->wait();
+                } else {
+                    clusterPartonJets(partonPJs, group.qcdawareakt,
+                            partonJetPtMin, aktPartonJets);
+                    clusterKtPartonJets(partonPJs, group.qcdawarekt,
+                            partonJetPtMin, ktPartonJets, ws);
+                    clusterPartonJets(partonPJs, group.qcdawareca,
+                            partonJetPtMin, caPartonJets);
+                }
+
+                if (partonJetMode != PartonJetGhost) {
+                    indexPartonJets(aktPartonJets, AktLabel, group.maxLabelDr, ws);
+                    indexPartonJets(ktPartonJets, KtLabel, group.maxLabelDr, ws);
+                    indexPartonJets(caPartonJets, CALabel, group.maxLabelDr, ws);
+                }
+
+                timePartons.stop();
+
+                StageTimer::Scope timeGhosts(timer, StageTimer::Ghosts);
+
+                // constituents for particle jets
+                vector<PseudoJet>& particlePJs = ws.particlePJs;
+                foreach (const Particle& p, in.visibleParticles) {
+                    PseudoJet pj = p.pseudojet();
+                    pj.set_user_info_shared_ptr(
+                            ws.userInfos.get(p, UserInfoParticle::VisibleParticle));
+                    particlePJs.push_back(pj);
+                }
+
+                // ghost association of parton jets to particle jets
+                unsigned int nGhosts[NPartonJetSchemes] = { 0, 0, 0 };
+                const bool ghostPartonJets = partonJetMode != PartonJetMatch;
+                if (ghostPartonJets) {
+                    foreach (const PseudoJet& aktPJ, aktPartonJets) {
+                        if (region && !nearJets(aktPJ.rap(), aktPJ.phi(), *region, regionDr))
+                            continue;
+
+                        particlePJs.push_back(
+                                ghost(Particle(aktPJ.user_index(), momentum(aktPJ)),
+                                    ws.userInfos, UserInfoParticle::GAAktPartonJet,
+                                    aktPJ.user_index()));
+                        nGhosts[AktLabel]++;
+                    }
+
+                    foreach (const PseudoJet& ktPJ, ktPartonJets) {
+                        if (region && !nearJets(ktPJ.rap(), ktPJ.phi(), *region, regionDr))
+                            continue;
+
+                        particlePJs.push_back(
+                                ghost(Particle(ktPJ.user_index(), momentum(ktPJ)),
+                                    ws.userInfos, UserInfoParticle::GAKtPartonJet,
+                                    ktPJ.user_index()));
+                        nGhosts[KtLabel]++;
+                    }
+
+                    foreach (const PseudoJet& caPJ, caPartonJets) {
+                        if (region && !nearJets(caPJ.rap(), caPJ.phi(), *region, regionDr))
+                            continue;
+
+                        particlePJs.push_back(
+                                ghost(Particle(caPJ.user_index(), momentum(caPJ)),
+                                    ws.userInfos, UserInfoParticle::GACAPartonJet,
+                                    caPJ.user_index()));
+                        nGhosts[CALabel]++;
+                    }
+                }
+
+                // ghost association of final partons to particle jets
+                unsigned int nFinalPartonGhosts = 0;
+                for (unsigned int i = 0; i < in.partonJetInputs.size(); i++) {
+                    const Particle& part = in.partonJetInputs[i];
+                    if (region && !nearJets(part.rap(), part.phi(), *region, regionDr))
+                        continue;
+
+                    particlePJs.push_back(ghost(part, ws.userInfos,
+                                UserInfoParticle::GAFinalParton, part.pid(), i));
+                    nFinalPartonGhosts++;
+                }
+
+                // ghost association of ALL partons to particle jets
+                // for max-pt labeling
+                unsigned int nPartonGhosts = 0;
+                if (maxPtMode != MaxPtMatch)
+                    foreach (const Particle& part, in.genPartons) {
+                        if (region && !nearJets(part.rap(), part.phi(), *region, regionDr))
+                            continue;
+
+                        particlePJs.push_back(ghost(part, ws.userInfos,
+                                    UserInfoParticle::GAParton, part.pid()));
+                        nPartonGhosts++;
+                    }
+
+                timeGhosts.stop();
+
+                if (instrumenting()) {
+                    unsigned int* counts = ws.counts.counts;
+                    counts[ParticleInputsCounter] += particlePJs.size();
+                    counts[AktGhostsCounter] += nGhosts[AktLabel];
+                    counts[KtGhostsCounter] += nGhosts[KtLabel];
+                    counts[CAGhostsCounter] += nGhosts[CALabel];
+                    counts[FinalPartonGhostsCounter] += nFinalPartonGhosts;
+                    counts[PartonGhostsCounter] += nPartonGhosts;
+                }
+
+                StageTimer::Scope timeClustering(timer, StageTimer::ParticleClustering);
+
+                ClusterSequence aktcs(particlePJs, JetDefinition(antikt_algorithm, group.jetR));
+
+                const vector<PseudoJet> aktJets =
+                    sorted_by_pt(aktcs.inclusive_jets(group.jetPtMin));
+
+                timeClustering.stop();
+
+                if (instrumenting())
+                    ws.counts.counts[JetsCounter] += aktJets.size();
+
+                StageTimer::Scope timeLabels(timer, StageTimer::JetLabels);
+
+                foreach (unsigned int icfg, group.configs) {
+                    const LabelConfig& cfg = configs[icfg];
+                    vector<LabeledJet>& cfgjets = labjets[icfg];
+
+                    cfgjets.clear();
+                    foreach (const PseudoJet& j, aktJets) {
+                        // same comparison as inclusive_jets(ptmin)
+                        if (j.perp2() < cfg.jetPtMin*cfg.jetPtMin)
+                            break;
+
+                        cfgjets.push_back(LabeledJet(j));
                     }
+
+                    labelJets(in, cfg, aktcs, ws, cfgjets);
                 }
+
+                return;
             }
 
-            void bookLabelComparison(const string& prefix,
-                    const string& lab1, const string& axis1,
-                    const string& lab2, const string& axis2) {
 
-                histos2D[prefix + "_" + lab1 + "LabVs" + lab2 + "Lab"] =
-                    bookHisto2D(prefix + "_" + lab1 + "LabVs" + lab2 + "Lab",
-                            51, -25.5, 25.5, 51, -25.5, 25.5,
-                            axis1 + " vs " + axis2,
-                            axis1, axis2, "entries");
+            // fill in the labels of one configuration's jets.
+            void labelJets(const EventInputs& in, const LabelConfig& cfg,
+                    const ClusterSequence& aktcs, EventWorkspace& ws,
+                    vector<LabeledJet>& labjets) const {
+
+                if (ws.reclusterScratch.size() < labjets.size())
+                    ws.reclusterScratch.resize(labjets.size());
+
+                if (labelPool && labjets.size() > 1) {
+                    for (unsigned int iJet = 0; iJet < labjets.size(); iJet++)
+                        labelPool->submit([this, &cfg, &labjets, &ws, iJet] {
+                                fillJetLabels(labjets[iJet], cfg, ws, ws.reclusterScratch[iJet]); });
+                    labelPool->wait();
+                } else {
+                    for (unsigned int iJet = 0; iJet < labjets.size(); iJet++)
+                        fillJetLabels(labjets[iJet], cfg, ws, ws.reclusterScratch[iJet]);
+                }
+
+                if (instrumenting())
+                    for (unsigned int iJet = 0; iJet < labjets.size(); iJet++)
+                        if (!ws.reclusterScratch[iJet].inputs.empty())
+                            ws.counts.reclusterInputs.push_back(
+                                    ws.reclusterScratch[iJet].inputs.size());
+
+                if (partonJetMode != PartonJetGhost)
+                    matchPartonJetLabels(cfg, labjets, ws);
+
+                if (maxPtMode == MaxPtGhost)
+                    return;
+
+                matchMaxPtLabels(in.genPartons, cfg.jetR, aktcs, labjets, ws);
+                for (unsigned int iJet = 0; iJet < labjets.size(); iJet++) {
+                    const Particle& matched = ws.maxPtMatches[iJet];
+                    LabeledJet& labjet = labjets[iJet];
+                    const Particle& label = labjet[MaxPtLabel];
+
+                    if (maxPtMode == MaxPtMatch) {
+                        // jets no parton was given to stay unlabelled.
+                        if (matched.pT() > 0)
+                            labjet.setLabel(MaxPtLabel, matched,
+                                    deltaR(labjet.momentum(), matched));
+                        continue;
+                    }
+
+                    ws.maxPtChecked++;
+                    if (matched.pid() != label.pid() || matched.pt() != label.pt())
+                        ws.maxPtDisagreements++;
+                    if (pidToFlavor(matched.pid()) != pidToFlavor(label.pid()))
+                        ws.maxPtFlavorDisagreements++;
+                }
+
+                return;
             }
 
-            // fills in the labels for a given jet
-            void fillJetLabels(LabeledJet& labjet) {
-                MSG_DEBUG("fillng jet labels.");
 
-                FourMomentum jp4 = momentum(labjet.pseudojet());
+            // keep a parton-jet scheme's jets, as labels, in an
+            // (eta, phi) grid for matchPartonJetLabels().
+            static void indexPartonJets(const vector<PseudoJet>& jets,
+                    unsigned int scheme, double radius, EventWorkspace& ws) {
 
-                // for recluster labling
-                vector<PseudoJet> partonReclusteredInputs;
+                vector<Particle>& partonJets = ws.partonJets[scheme];
+                partonJets.clear();
+                ws.partonJetEtas.clear();
+                ws.partonJetPhis.clear();
+                foreach (const PseudoJet& pj, jets) {
+                    partonJets.push_back(Particle(pj.user_index(), momentum(pj)));
+                    ws.partonJetEtas.push_back(partonJets.back().eta());
+                    ws.partonJetPhis.push_back(partonJets.back().phi());
+                }
+
+                ws.partonJetGrids[scheme].build(ws.partonJetEtas, ws.partonJetPhis, radius);
+            }
 
-                foreach (const PseudoJet& pj, labjet.pseudojet().constituents()) {
-                    const UserInfoParticle& uip = pj.user_info<UserInfoParticle>();
-                    const string& s = uip.str();
-                    const Particle& part = uip.particle();
 
-                    if (s == "Particle")
+            // Akt, Kt and CA labels without ghosts: each jet takes the
+            // nearest parton jet of each scheme within the label dR.
+            // Ghost association would give it the same one unless that
+            // parton jet clusters into a neighbouring jet instead.
+            // PartonJetValidate only compares the two.
+            void matchPartonJetLabels(const LabelConfig& cfg,
+                    vector<LabeledJet>& labjets, EventWorkspace& ws) const {
+
+                for (unsigned int ischeme = 0; ischeme < NPartonJetSchemes; ischeme++) {
+                    const LabelScheme lab = LabelScheme(ischeme);
+                    const vector<Particle>& partonJets = ws.partonJets[ischeme];
+                    const EtaPhiGrid& grid = ws.partonJetGrids[ischeme];
+
+                    foreach (LabeledJet& labjet, labjets) {
+                        const FourMomentum& jp4 = labjet.momentum();
+
+                        // ties go to the harder parton jet.
+                        int best = -1;
+                        double bestDr = 0;
+                        grid.forEachNear(jp4.eta(), jp4.phi(), [&] (unsigned int i) {
+                                const Particle& part = partonJets[i];
+                                if (part.pT() < cfg.partonJetPtMin)
+                                    return;
+
+                                const double dr = deltaR(jp4, part);
+                                if (dr > cfg.maxLabelDr)
+                                    return;
+
+                                if (best < 0 || dr < bestDr || (dr == bestDr && int(i) < best)) {
+                                    best = i;
+                                    bestDr = dr;
+                                }
+                            });
+
+                        if (partonJetMode == PartonJetMatch) {
+                            if (best >= 0)
+                                labjet.setLabel(lab, partonJets[best], bestDr);
+                            continue;
+                        }
+
+                        const Particle& ghostLabel = labjet[lab];
+                        const bool agree = best < 0 ? !labjet.isLabeled(lab) :
+                            labjet.isLabeled(lab) &&
+                            ghostLabel.pid() == partonJets[best].pid() &&
+                            ghostLabel.pt() == partonJets[best].pt();
+
+                        ws.partonJetChecked[ischeme]++;
+                        if (agree)
+                            ws.partonJetAgreements[ischeme]++;
+
+                        const int ghostFlav = pidToFlavor(ghostLabel.pid());
+                        const int matchFlav = best < 0 ? int(UnlabeledFlavor) :
+                            pidToFlavor(partonJets[best].pid());
+                        if (ghostFlav >= 0 && matchFlav >= 0)
+                            ws.partonJetMigrations[ischeme][ghostFlav][matchFlav]++;
+                    }
+                }
+            }
+
+
+            // per parton-jet scheme: how often dR matching gives the
+            // ghost label, and the flavour migrations when it doesn't.
+            void reportPartonJetMatching() const {
+                vector<const EventWorkspace*> workspaces(1, &serialWorkspace);
+                foreach (const EventWorkspace& w, eventWorkspaces)
+                    workspaces.push_back(&w);
+
+                for (unsigned int ischeme = 0; ischeme < NPartonJetSchemes; ischeme++) {
+                    unsigned long nChecked = 0;
+                    unsigned long nAgree = 0;
+                    unsigned long migrations[NLabelFlavors][NLabelFlavors] = {};
+                    foreach (const EventWorkspace* w, workspaces) {
+                        nChecked += w->partonJetChecked[ischeme];
+                        nAgree += w->partonJetAgreements[ischeme];
+                        for (unsigned int i = 0; i < NLabelFlavors; i++)
+                            for (unsigned int j = 0; j < NLabelFlavors; j++)
+                                migrations[i][j] += w->partonJetMigrations[ischeme][i][j];
+                    }
+
+                    MSG_INFO(labels[ischeme] << " labels, dR matching vs. ghost association: "
+                            << nChecked << " jets checked, "
+                            << 100.0*nAgree/max(nChecked, 1UL) << "% identical.");
+
+                    // rows: ghost label flavour; columns: matched.
+                    string header = "  ghost \\ matched";
+                    for (unsigned int j = 0; j < NLabelFlavors; j++) {
+                        char col[16];
+                        snprintf(col, sizeof(col), " %10s", flavors[j].c_str());
+                        header += col;
+                    }
+                    MSG_INFO(header);
+
+                    for (unsigned int i = 0; i < NLabelFlavors; i++) {
+                        char row[32];
+                        snprintf(row, sizeof(row), "  %-15s", flavors[i].c_str());
+                        string line = row;
+                        for (unsigned int j = 0; j < NLabelFlavors; j++) {
+                            char col[16];
+                            snprintf(col, sizeof(col), " %10lu", migrations[i][j]);
+                            line += col;
+                        }
+                        MSG_INFO(line);
+                    }
+                }
+            }
+
+
+            // MaxPt labels without ghosts: each parton is given to the
+            // jet it is closest to in the anti-kt measure dR^2/pT^2,
+            // among all jets of cs within R of it, which is where
+            // anti-kt clustering would put a ghost in all but rare
+            // boundary cases. ws.maxPtMatches[i] is the highest-pT
+            // parton given to labjets[i].
+            void matchMaxPtLabels(const vector<Particle>& partons, double R,
+                    const ClusterSequence& cs, const vector<LabeledJet>& labjets,
+                    EventWorkspace& ws) const {
+
+                ws.maxPtMatches.assign(labjets.size(), Particle(0, FourMomentum(0, 0, 0, 0)));
+                if (labjets.empty())
+                    return;
+
+                vector<PseudoJet>& allJets = ws.allJets;
+                allJets = cs.inclusive_jets();
+
+                const double R2 = R*R;
+                foreach (const Particle& part, partons) {
+                    const PseudoJet pj = part.pseudojet();
+
+                    // cheap reject: nowhere near any labelled jet.
+                    bool nearLabeled = false;
+                    foreach (const LabeledJet& labjet, labjets) {
+                        if (pj.squared_distance(labjet.pseudojet()) < R2) {
+                            nearLabeled = true;
+                            break;
+                        }
+                    }
+
+                    if (!nearLabeled)
                         continue;
 
+                    int best = -1;
+                    double bestDist = 0;
+                    for (unsigned int i = 0; i < allJets.size(); i++) {
+                        const double dr2 = pj.squared_distance(allJets[i]);
+                        const double pt2 = allJets[i].pt2();
+                        if (dr2 >= R2 || pt2 <= 0)
+                            continue;
 
-                    // ghost associated partons
-                    if (s == "GAFinalParton") {
+                        const double dist = dr2/pt2;
+                        if (best < 0 || dist < bestDist) {
+                            best = i;
+                            bestDist = dist;
+                        }
+                    }
+
+                    if (best < 0)
+                        continue;
+
+                    const int hist = allJets[best].cluster_hist_index();
+                    for (unsigned int iJet = 0; iJet < labjets.size(); iJet++) {
+                        if (labjets[iJet].pseudojet().cluster_hist_index() != hist)
+                            continue;
+
+                        if (part.pT() > ws.maxPtMatches[iJet].pT())
+                            ws.maxPtMatches[iJet] = part;
+
+                        break;
+                    }
+                }
+
+                return;
+            }
+
+
+            // fill one event's labelled jets, in configuration and jet
+            // order.
+            void fillEvent(const vector<vector<LabeledJet> >& labjets,
+                    const vector<double>& weights) {
+                StageTimer::Scope timeIt(timing ? &analyzeTimer : NULL,
+                        StageTimer::Filling);
+
+                for (unsigned int i = 1; i < weights.size(); i++)
+                    streamSumOfWeights[i]->fill(weights[i]);
+
+                for (unsigned int icfg = 0; icfg < configs.size(); icfg++) {
+                    LabelConfig& cfg = configs[icfg];
+                    const vector<LabeledJet>& cfgjets = labjets[icfg];
+
+                    for (unsigned int iJet = 0; iJet < cfgjets.size(); iJet++) {
+                        fillLabelHistos(cfg, InclusiveSlot, cfgjets[iJet], weights);
+
+                        if (Jet0Slot + iJet < NJetSlots)
+                            fillLabelHistos(cfg, Jet0Slot + iJet, cfgjets[iJet], weights);
+                    }
+                }
+
+                if (jetRecords)
+                    writeJetRecords(labjets[0], weights[0]);
+
+                nRecordedEvents++;
+            }
+
+
+            // one record per jet, its rank being its place in pT order.
+            // dR is -1 for jets without a label.
+            void writeJetRecords(const vector<LabeledJet>& labjets, double weight) {
+                for (unsigned int iJet = 0; iJet < labjets.size(); iJet++) {
+                    const LabeledJet& labjet = labjets[iJet];
+                    const PseudoJet& pj = labjet.pseudojet();
+                    jetRecords->add(nRecordedEvents, weight, iJet,
+                            pj.px(), pj.py(), pj.pz(), pj.E());
+
+                    for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++) {
+                        const LabelScheme lab = LabelScheme(ilab);
+                        const Particle& labelpart = labjet[lab];
+                        const double dr = labjet.isLabeled(lab) ? labjet.labelDr(lab) : -1;
+                        jetRecords->setLabel(ilab, labelpart.pid(), labelpart.pt(), dr);
+                    }
+                }
+            }
+
+
+            // read the min-bias events' visible particles, with the same
+            // selection as the VisibleFinalState projection, and book
+            // the scaling profile.
+            void initPileup(const string& fname) {
+                istringstream points(envString("QCDAWARE_PILEUP_N", "10"));
+                string point;
+                while (getline(points, point, ','))
+                    if (!point.empty())
+                        pileupPoints.push_back(PileupPoint(max(atoi(point.c_str()), 0)));
+
+                pileupBlock = max(envOption("QCDAWARE_PILEUP_EVENTS", 100), 1);
+
+                HepMC::IO_GenEvent input(fname, ios::in);
+                while (HepMC::GenEvent* ge = input.read_next_event()) {
+                    pileupEvents.push_back(vector<Particle>());
+                    for (HepMC::GenEvent::particle_const_iterator it = ge->particles_begin();
+                            it != ge->particles_end(); ++it) {
+                        const GenParticle* gp = *it;
+                        if (gp->status() != 1 || gp->end_vertex())
+                            continue;
+
+                        // no links into an event about to be deleted.
+                        const Particle p(gp);
+                        if (p.isNeutrino() || p.abseta() > 2.5)
+                            continue;
+
+                        pileupEvents.back().push_back(Particle(p.pid(), p.momentum()));
+                    }
+
+                    delete ge;
+                }
+
+                if (pileupEvents.empty() || pileupPoints.empty()) {
+                    MSG_WARNING("no min-bias events in " << fname
+                            << " or no QCDAWARE_PILEUP_N; not overlaying pile-up.");
+                    pileupPoints.clear();
+                    return;
+                }
+
+                MSG_INFO("overlaying pile-up from " << pileupEvents.size()
+                        << " min-bias events in " << fname);
+            }
+
+
+            // add the visible particles of the next min-bias events,
+            // cycling through the file.
+            void overlayPileup(EventInputs& in) {
+                const unsigned int point =
+                    min(nPileupEvents++/pileupBlock, (unsigned long) pileupPoints.size()-1);
+                in.pileupPoint = point;
+                in.nEventVisible = in.visibleParticles.size();
+
+                for (unsigned int i = 0; i < pileupPoints[point].nOverlay; i++) {
+                    const vector<Particle>& minbias = pileupEvents[nextPileupEvent];
+                    in.visibleParticles.insert(in.visibleParticles.end(),
+                            minbias.begin(), minbias.end());
+                    nextPileupEvent = (nextPileupEvent + 1) % pileupEvents.size();
+                }
+            }
+
+
+            void fillPileup(const EventInputs& in, double seconds) {
+                PileupPoint& point = pileupPoints[in.pileupPoint];
+                point.nEvents++;
+                point.visibleSum += in.visibleParticles.size();
+                point.labelSeconds += seconds;
+                point.maxLabelSeconds = max(point.maxLabelSeconds, seconds);
+
+                struct rusage usage;
+                if (getrusage(RUSAGE_SELF, &usage) == 0)
+                    point.peakRssKb = max(point.peakRssKb, long(usage.ru_maxrss));
+            }
 
-                        // save pseudojet for reclustering
-                        PseudoJet partPJ = part.pseudojet();
-                        partPJ.set_user_index(part.pid());
-                        partPJ.set_user_info(new UserInfoParticle(part, "Parton"));
-                        partonReclusteredInputs.push_back(partPJ);
 
+            void reportPileup() const {
+                MSG_INFO("labelling cost vs pile-up overlay:");
+                MSG_INFO("  overlay     events    visible   ms/event     max ms   peak RSS/MB");
+                foreach (const PileupPoint& point, pileupPoints) {
+                    const double n = max(point.nEvents, 1UL);
+                    char line[128];
+                    snprintf(line, sizeof(line), "  %7u %10lu %10.0f %10.2f %10.2f %13.1f",
+                            point.nOverlay, point.nEvents, point.visibleSum/n,
+                            1000*point.labelSeconds/n, 1000*point.maxLabelSeconds,
+                            point.peakRssKb/1024.);
+                    MSG_INFO(line);
+                }
+            }
+
+
+            // print the time spent in each stage, summed over threads.
+            void reportTiming() const {
+                StageTimer total = analyzeTimer;
+                total += serialWorkspace.timer;
+                foreach (const EventWorkspace& w, eventWorkspaces)
+                    total += w.timer;
+
+                const unsigned long nEvents = max(analyzeTimer.calls(StageTimer::Projections), 1UL);
+
+                MSG_INFO("time per stage over " << nEvents << " events:");
+                for (unsigned int i = 0; i < StageTimer::NStages; i++) {
+                    const StageTimer::Stage stage = StageTimer::Stage(i);
+                    const double seconds = total.seconds(stage);
+                    char line[128];
+                    snprintf(line, sizeof(line), "  %-28s %10.3f s %10.3f ms/event %12.1f events/s",
+                            StageTimer::name(stage), seconds, 1000*seconds/nEvents,
+                            seconds > 0 ? nEvents/seconds : 0.0);
+                    MSG_INFO(line);
+                }
+            }
+
+
+            // QCDAWARE_SWEEP="R:dR:partonJetPtMin:jetPtMin,..." adds
+            // a configuration for each comma-separated entry, with the
+            // pT cuts in GeV.
+            void addSweepConfigs(const string& sweep) {
+                istringstream entries(sweep);
+                string entry;
+                while (getline(entries, entry, ',')) {
+                    if (entry.empty())
+                        continue;
+
+                    double r, dr, partonptmin, ptmin;
+                    char c1, c2, c3;
+                    istringstream ss(entry);
+                    if (!(ss >> r >> c1 >> dr >> c2 >> partonptmin >> c3 >> ptmin) ||
+                            c1 != ':' || c2 != ':' || c3 != ':' || r <= 0) {
+                        MSG_WARNING("ignoring malformed QCDAWARE_SWEEP entry " << entry);
                         continue;
                     }
 
+                    LabelConfig cfg(r, dr, partonptmin*GeV, ptmin*GeV);
 
-                    if (s == "GAParton") {
-                        // note the highest-pt parton
-                        if (part.pT() > labjet["MaxPt"].pT()) {
-                            labjet["MaxPt"] = part;
-                            MSG_DEBUG("giving jet MaxPt label");
-                        }
+                    // e.g. R060_DR030_PJ5_J25_, the radii in hundredths.
+                    char prefix[64];
+                    snprintf(prefix, sizeof(prefix), "R%03d_DR%03d_PJ%g_J%g_",
+                            int(lround(100*r)), int(lround(100*dr)),
+                            partonptmin, ptmin);
+                    cfg.prefix = prefix;
 
+                    bool duplicate = false;
+                    foreach (const LabelConfig& other, configs)
+                        if (other.jetR == cfg.jetR && other.maxLabelDr == cfg.maxLabelDr &&
+                                other.partonJetPtMin == cfg.partonJetPtMin &&
+                                other.jetPtMin == cfg.jetPtMin)
+                            duplicate = true;
+
+                    if (duplicate) {
+                        MSG_WARNING("ignoring repeated QCDAWARE_SWEEP entry " << entry);
                         continue;
                     }
 
-                    // store best-matched parton label jet
-                    if (deltaR(jp4, part) > maxLabelDr)
+                    MSG_INFO("sweep configuration " << cfg.prefix << ": R = " << r
+                            << ", label dR < " << dr << ", parton jets > " << partonptmin
+                            << " GeV, jets > " << ptmin << " GeV");
+                    configs.push_back(cfg);
+                }
+            }
+
+
+            // with lazy booking the tables are left full of NULL
+            // handles, for fillLabelHistos() to book.
+            void bookLabelConfig(LabelConfig& cfg) {
+                const unsigned int nStreams = weightStreams.size();
+                cfg.labelHistoTable.resize(nStreams*NJetSlots*NLabelFlavors*NLabelSchemes);
+                cfg.labelComparisonTable.resize(nStreams*NJetSlots*nLabelComparisons());
+                if (lazyBooking)
+                    return;
+
+                for (unsigned int istream = 0; istream < nStreams; istream++) {
+                    for (unsigned int islot = 0; islot < NJetSlots; islot++)
+                        for (unsigned int iflav = 0; iflav < NLabelFlavors; iflav++)
+                            for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++)
+                                bookLabelHistos(
+                                        cfg.labelHistoTable[labelHistoIndex(istream, islot, iflav, ilab)],
+                                        labelHistoName(cfg, istream, islot, iflav, ilab));
+
+                    for (unsigned int islot = 0; islot < NJetSlots; islot++) {
+                        unsigned int icomp = 0;
+                        for (unsigned int i = 0; i < NLabelSchemes; i++)
+                            for (unsigned int j = i+1; j < NLabelSchemes; j++)
+                                cfg.labelComparisonTable[labelComparisonIndex(istream, islot, icomp++)] =
+                                    bookLabelComparison(cfg, istream, islot, i, j);
+                    }
+                }
+            }
+
+
+            string labelHistoName(const LabelConfig& cfg, unsigned int stream,
+                    unsigned int slot, unsigned int flav, unsigned int lab) const {
+                return streamPrefixes[stream] + cfg.prefix + leadlabs[slot] + "_"
+                    + flavors[flav] + "_" + labels[lab];
+            }
+
+
+            // the nominal stream, then one per listed weight index.
+            void initWeightStreams(const string& indices) {
+                weightStreams.assign(1, 0);
+                streamPrefixes.assign(1, "");
+                streamSumOfWeights.assign(1, CounterPtr());
+
+                istringstream entries(indices);
+                string entry;
+                while (getline(entries, entry, ',')) {
+                    if (entry.empty())
                         continue;
 
-                    if (s == "GAAktPartonJet" &&
-                            (!labjet["Akt"].pt() ||
-                             deltaR(jp4, part) < deltaR(jp4, labjet["Akt"]))) {
-                        MSG_DEBUG("giving jet Akt label.");
-                        labjet["Akt"] = part;
+                    // the whole entry must be the index, give or take
+                    // spaces around it.
+                    char* end;
+                    const long index = strtol(entry.c_str(), &end, 10);
+                    while (isspace(*end))
+                        end++;
+
+                    if (*end || end == entry.c_str() || index <= 0 || index > INT_MAX ||
+                            std::find(weightStreams.begin(), weightStreams.end(),
+                                (unsigned int) index) != weightStreams.end()) {
+                        MSG_WARNING("ignoring QCDAWARE_WEIGHTS entry \"" << entry << "\"");
+                        continue;
+                    }
+
+                    char prefix[32];
+                    snprintf(prefix, sizeof(prefix), "Weight%ld_", index);
+                    weightStreams.push_back(index);
+                    streamPrefixes.push_back(prefix);
+                    streamSumOfWeights.push_back(bookCounter(string(prefix) + "SumOfWeights"));
+                }
+
+                if (weightStreams.size() > 1)
+                    MSG_INFO("filling " << weightStreams.size() - 1
+                            << " weight variations besides the nominal weight.");
+            }
+
+
+            // the event's weight for each stream. Events with fewer
+            // weights than asked for count with their nominal weight.
+            void gatherWeights(const Event& event, EventInputs& in) {
+                in.weights.assign(weightStreams.size(), in.weight);
+                if (weightStreams.size() == 1)
+                    return;
+
+                const HepMC::WeightContainer& weights = event.genEvent()->weights();
+                for (unsigned int i = 1; i < weightStreams.size(); i++) {
+                    if (weightStreams[i] < weights.size()) {
+                        in.weights[i] = weights[weightStreams[i]];
+                    } else if (!warnedMissingWeights) {
+                        MSG_WARNING("event has " << weights.size() << " weights, not "
+                                << weightStreams[i] + 1 << "; using its nominal weight.");
+                        warnedMissingWeights = true;
+                    }
+                }
+            }
+
+
+            double streamSumW(unsigned int stream) const {
+                return stream ? streamSumOfWeights[stream]->sumW() : sumOfWeights();
+            }
+
+
+            // move every booked flavour/label category out of the main
+            // output into its own file, with the category taken out of
+            // the histogram paths.
+            void writeLabelShards() {
+                foreach (const LabelConfig& cfg, configs) {
+                    for (unsigned int istream = 0; istream < weightStreams.size(); istream++)
+                        for (unsigned int islot = 0; islot < NJetSlots; islot++)
+                            for (unsigned int iflav = 0; iflav < NLabelFlavors; iflav++)
+                                for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++) {
+                                    const LabelHistos& h =
+                                        cfg.labelHistoTable[labelHistoIndex(istream, islot, iflav, ilab)];
+                                    if (!h.pt)
+                                        continue;
+
+                                    vector<AnalysisObjectPtr> aos;
+                                    aos.push_back(h.pt);
+                                    aos.push_back(h.dpt);
+                                    aos.push_back(h.dr);
+                                    aos.push_back(h.meanDrVsPt);
+                                    aos.push_back(h.meanDptVsDr);
+                                    aos.push_back(h.meanDptVsPt);
+                                    aos.push_back(h.drDpt);
+
+                                    const string name = labelHistoName(cfg, istream, islot, iflav, ilab);
+
+                                    vector<AnalysisObjectPtr> shard;
+                                    foreach (const AnalysisObjectPtr& ao, aos) {
+                                        // e.g. .../Inclusive_Gluon_Akt_Pt -> .../Pt
+                                        const string path = ao->path();
+                                        AnalysisObjectPtr clone(ao->newclone());
+                                        clone->setPath(histoDir() + "/" +
+                                                path.substr(path.rfind(name + "_") + name.size() + 1));
+                                        shard.push_back(clone);
+
+                                        removeAnalysisObject(ao);
+                                    }
+
+                                    YODA::WriterYODA::write(shardPrefix + "_" + name + ".yoda",
+                                            shard.begin(), shard.end());
+                                }
+                }
+            }
+
+
+            void initCheckpoint() {
+                checkpointEvents = max(envOption("QCDAWARE_CHECKPOINT_EVENTS", 10000), 1);
+                checkpointSeconds = envOption("QCDAWARE_CHECKPOINT_SECONDS", 600);
+                checkpointState.setPath(histoDir() + "/CheckpointState");
+                lastCheckpoint = chrono::steady_clock::now();
+
+                MSG_INFO("checkpointing to " << checkpointFile << " every "
+                        << checkpointEvents << " events or " << checkpointSeconds << " s");
+
+                // YODA writes 6 significant digits by default, and a
+                // resumed run would add back the rounded sums. The
+                // writer is YODA's shared one, so the run's other .yoda
+                // output gets full precision too; set here, before any
+                // snapshot thread is running.
+                YODA::WriterYODA::create().setPrecision(17);
+
+                if (envOption("QCDAWARE_RESUME", 0) > 0)
+                    resumeCheckpoint();
+            }
+
+
+            // add the snapshot's contents to the booked objects and
+            // arrange to skip the events it covers.
+            void resumeCheckpoint() {
+                if (!ifstream(checkpointFile.c_str())) {
+                    MSG_INFO("no checkpoint " << checkpointFile << " yet; starting from scratch.");
+                    return;
+                }
+
+                vector<YODA::AnalysisObject*> aos;
+                YODA::ReaderYODA::create().read(checkpointFile, aos);
+
+                map<string, YODA::AnalysisObject*> saved;
+                foreach (YODA::AnalysisObject* ao, aos)
+                    saved[ao->path()] = ao;
+
+                const YODA::Counter* state = NULL;
+                if (saved.count(checkpointState.path()))
+                    state = dynamic_cast<const YODA::Counter*>(saved[checkpointState.path()]);
+
+                if (!state) {
+                    MSG_WARNING(checkpointFile << " is not a checkpoint of this analysis; "
+                            << "starting from scratch.");
+                } else {
+                    checkpointState = *state;
+                    nResumeEvents = lround(state->numEntries());
+                    nRecordedEvents = nResumeEvents;
+
+                    if (lazyBooking)
+                        bookCheckpointedLabels(saved);
+
+                    unsigned int nRestored = 0;
+                    foreach (const AnalysisObjectPtr& ao, analysisObjects()) {
+                        map<string, YODA::AnalysisObject*>::const_iterator it = saved.find(ao->path());
+                        if (it == saved.end())
+                            continue;
+
+                        if (addCheckpointed<YODA::Histo1D>(*ao, *it->second) ||
+                                addCheckpointed<YODA::Histo2D>(*ao, *it->second) ||
+                                addCheckpointed<YODA::Profile1D>(*ao, *it->second) ||
+                                addCheckpointed<YODA::Counter>(*ao, *it->second))
+                            nRestored++;
                     }
 
-                    else if (s == "GAKtPartonJet" &&
-                            (!labjet["Kt"].pt() ||
-                             deltaR(jp4, part) < deltaR(jp4, labjet["Kt"]))) {
-                        MSG_DEBUG("giving jet Kt label.");
-                        labjet["Kt"] = part;
+                    MSG_INFO("resuming from " << checkpointFile << ": " << nRestored
+                            << " objects restored, skipping the first "
+                            << nResumeEvents << " events.");
+                }
+
+                foreach (YODA::AnalysisObject* ao, aos)
+                    delete ao;
+            }
+
+
+            // book the lazily booked histograms that the snapshot has,
+            // so that they are there to add it to.
+            void bookCheckpointedLabels(const map<string, YODA::AnalysisObject*>& saved) {
+                foreach (LabelConfig& cfg, configs) {
+                    for (unsigned int istream = 0; istream < weightStreams.size(); istream++)
+                        for (unsigned int islot = 0; islot < NJetSlots; islot++) {
+                            for (unsigned int iflav = 0; iflav < NLabelFlavors; iflav++)
+                                for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++) {
+                                    const string name = labelHistoName(cfg, istream, islot, iflav, ilab);
+                                    LabelHistos& h =
+                                        cfg.labelHistoTable[labelHistoIndex(istream, islot, iflav, ilab)];
+                                    if (!h.pt && saved.count(histoDir() + "/" + name + "_Pt"))
+                                        bookLabelHistos(h, name);
+                                }
+
+                            unsigned int icomp = 0;
+                            for (unsigned int i = 0; i < NLabelSchemes; i++)
+                                for (unsigned int j = i+1; j < NLabelSchemes; j++) {
+                                    Histo2DPtr& matrix =
+                                        cfg.labelComparisonTable[labelComparisonIndex(istream, islot, icomp++)];
+                                    const string name = streamPrefixes[istream] + cfg.prefix
+                                        + leadlabs[islot] + "_" + labels[i] + "LabVs" + labels[j] + "Lab";
+                                    if (!matrix && saved.count(histoDir() + "/" + name))
+                                        matrix = bookLabelComparison(cfg, istream, islot, i, j);
+                                }
+                        }
+                }
+            }
+
+
+            template <typename T>
+            static bool addCheckpointed(YODA::AnalysisObject& ao, const YODA::AnalysisObject& saved) {
+                T* booked = dynamic_cast<T*>(&ao);
+                const T* snapshot = dynamic_cast<const T*>(&saved);
+                if (!booked || !snapshot)
+                    return false;
+
+                *booked += *snapshot;
+                return true;
+            }
+
+
+            void checkResumedWeights() {
+                const double sumW = checkpointState.sumW();
+                if (fabs(skippedSumW - sumW) > 1e-6*max(fabs(sumW), 1e-300))
+                    MSG_WARNING("the skipped events' sum of weights is " << skippedSumW
+                            << ", not " << sumW << " as in " << checkpointFile
+                            << "; were they the same events?");
+                else
+                    MSG_INFO("skipped " << nSkipped << " checkpointed events.");
+            }
+
+
+            // called for every committed event.
+            void checkpointEvent(double weight) {
+                checkpointState.fill(weight);
+                nSinceCheckpoint++;
+
+                if (nSinceCheckpoint < checkpointEvents &&
+                        chrono::duration<double>(chrono::steady_clock::now() - lastCheckpoint).count()
+                        < checkpointSeconds)
+                    return;
+
+                // rather than wait for the last snapshot to be written,
+                // try again after the next event.
+                if (checkpointWriting)
+                    return;
+
+                if (checkpointThread.joinable())
+                    checkpointThread.join();
+
+                if (checkpointFailed) {
+                    MSG_WARNING("could not write checkpoint " << checkpointFile);
+                    checkpointFailed = false;
+                }
+
+                writeCheckpoint();
+            }
+
+
+            // copy everything now; the writer thread only sees the
+            // copies.
+            void writeCheckpoint() {
+                vector<AnalysisObjectPtr> snapshot;
+                foreach (const AnalysisObjectPtr& ao, analysisObjects())
+                    snapshot.push_back(AnalysisObjectPtr(ao->newclone()));
+                snapshot.push_back(AnalysisObjectPtr(checkpointState.newclone()));
+
+                MSG_DEBUG("checkpointing " << lround(checkpointState.numEntries()) << " events.");
+
+                // so that a resumed run can keep these events' records.
+                if (jetRecords)
+                    jetRecords->flush();
+                if (skimWriter)
+                    skimWriter->flush();
+
+                nSinceCheckpoint = 0;
+                lastCheckpoint = chrono::steady_clock::now();
+                checkpointWriting = true;
+
+                const string path = checkpointFile;
+                checkpointThread = thread([this, snapshot, path] {
+                        // a reader never sees a half-written snapshot.
+                        const string tmp = path + ".tmp";
+                        try {
+                            YODA::WriterYODA::create().write(tmp, snapshot.begin(), snapshot.end());
+                            if (rename(tmp.c_str(), path.c_str()) != 0)
+                                checkpointFailed = true;
+                        } catch (...) {
+                            checkpointFailed = true;
+                        }
+
+                        checkpointWriting = false;
+                    });
+            }
+
+
+            // label a queued event on an event-pool thread, using
+            // whichever workspace is free.
+            void labelEventTask(EventTask& task) {
+                EventWorkspace *w;
+                {
+                    unique_lock<mutex> lock(eventMutex);
+                    w = freeWorkspaces.back();
+                    freeWorkspaces.pop_back();
+                }
+
+                exception_ptr error;
+                try {
+                    labelEvent(task.inputs, *w, task.labjets);
+                    if (instrumenting())
+                        task.counts = w->counts;
+                    task.labelSeconds = w->labelSeconds;
+                } catch (...) {
+                    error = current_exception();
+                }
+
+                {
+                    unique_lock<mutex> lock(eventMutex);
+                    freeWorkspaces.push_back(w);
+                    task.error = error;
+                    task.done = true;
+                }
+                eventDone.notify_all();
+            }
+
+
+            // fill every queued event before number upto, in
+            // submission order, waiting for them as necessary.
+            void commitEvents(unsigned long upto) {
+                while (nCommitted < upto) {
+                    EventTask& task = eventTasks[nCommitted % eventTasks.size()];
+                    {
+                        unique_lock<mutex> lock(eventMutex);
+                        while (!task.done)
+                            eventDone.wait(lock);
                     }
 
-                    else if (s == "GACAPartonJet" &&
-                            (!labjet["CA"].pt() ||
-                             deltaR(jp4, part) < deltaR(jp4, labjet["CA"]))) {
-                        MSG_DEBUG("giving jet CA label.");
-                        labjet["CA"] = part;
+                    commitEvent(task);
+                }
+            }
+
+
+            // fill queued events that have already been labelled, up
+            // to the first one that hasn't.
+            void commitFinishedEvents() {
+                while (nCommitted < nSubmitted) {
+                    EventTask& task = eventTasks[nCommitted % eventTasks.size()];
+                    {
+                        unique_lock<mutex> lock(eventMutex);
+                        if (!task.done)
+                            return;
                     }
+
+                    commitEvent(task);
+                }
+            }
+
+
+            void commitEvent(EventTask& task) {
+                nCommitted++;
+
+                if (task.error)
+                    rethrow_exception(task.error);
+
+                fillEvent(task.labjets, task.inputs.weights);
+                if (instrumenting())
+                    fillCounters(task.counts);
+                if (task.inputs.pileupPoint >= 0)
+                    fillPileup(task.inputs, task.labelSeconds);
+                if (!checkpointFile.empty())
+                    checkpointEvent(task.inputs.weight);
+            }
+
+
+            // always false when the instrumentation is compiled out, so
+            // that the compiler drops it.
+            bool instrumenting() const {
+#ifdef QCDAWARE_NO_INSTRUMENTATION
+                return false;
+#else
+                return instrument;
+#endif
+            }
+
+
+            // these are bookkeeping, not physics: they are filled with
+            // unit weight and left unscaled.
+            void bookCounters() {
+                for (unsigned int i = 0; i < NEventCounters; i++)
+                    counterHistos.push_back(
+                            bookHisto1D("Instrumentation_" + counterNames[i],
+                                100, 0, counterMax[i], counterNames[i] + " per event",
+                                counterNames[i], "events"));
+
+                reclusterInputsHisto =
+                    bookHisto1D("Instrumentation_ReclusterInputs", 50, 0, 50,
+                            "Reclustered label inputs", "partons", "reclusterings");
+
+                counterSums.assign(NEventCounters, 0);
+                counterMaxima.assign(NEventCounters, 0);
+            }
+
+
+            void fillCounters(const EventCounts& counts) {
+                nCountedEvents++;
+                for (unsigned int i = 0; i < NEventCounters; i++) {
+                    counterHistos[i]->fill(counts.counts[i]);
+                    counterSums[i] += counts.counts[i];
+                    counterMaxima[i] = max(counterMaxima[i], (unsigned long) counts.counts[i]);
+                }
+
+                foreach (unsigned int n, counts.reclusterInputs) {
+                    reclusterInputsHisto->fill(n);
+                    nReclusters++;
+                    reclusterInputSum += n;
+                    reclusterInputMax = max(reclusterInputMax, (unsigned long) n);
+                }
+            }
+
+
+            void reportCounters() const {
+                const double nEvents = max(nCountedEvents, 1UL);
+
+                MSG_INFO("per-event counts over " << nCountedEvents << " events:");
+                for (unsigned int i = 0; i < NEventCounters; i++) {
+                    char line[128];
+                    snprintf(line, sizeof(line), "  %-28s %10.1f mean %10lu max",
+                            counterNames[i].c_str(), counterSums[i]/nEvents,
+                            counterMaxima[i]);
+                    MSG_INFO(line);
+                }
+
+                MSG_INFO("  " << nReclusters << " Reclustered labels reclustered, "
+                        << double(reclusterInputSum)/max(nReclusters, 1UL)
+                        << " inputs on average, " << reclusterInputMax << " at most.");
+            }
+
+
+            void bookLabelHistos(LabelHistos& h, const string& basename) {
+
+                MSG_DEBUG(string("booking label histograms: ") + basename);
+
+                h.pt =
+                    bookHisto1D(basename + "_Pt", 50, 0, 100*GeV, "$p_T$",
+                            "$p_T$ / GeV", "entries");
+
+                h.dpt =
+                    bookHisto1D(basename + "_Dpt", 50, -1, 1, "$p_T$ resolution",
+                            "$p_T$ resolution", "entries");
+
+                h.dr =
+                    bookHisto1D(basename + "_Dr", 50, 0, 1,
+                            "$\\Delta R$", "$\\Delta R$", "entries");
+
+                h.meanDrVsPt =
+                    bookProfile1D(basename + "_MeanDrVsPt", 50, 0, 100*GeV,
+                            "mean $\\Delta R$ vs $p_T$", "$p_T$ / GeV", "$\\Delta R$");
+
+                h.meanDptVsDr =
+                    bookProfile1D(basename + "_MeanDptVsDr", 50, 0, 1,
+                            "mean $p_T$ resolution vs $\\Delta R$", "$\\Delta R$", "$p_T$ resolution");
+
+                h.meanDptVsPt =
+                    bookProfile1D(basename + "_MeanDptVsPt", 50, 0, 100*GeV,
+                            "mean $p_T$ resolution vs $p_T$", "$p_T$ / GeV", "$p_T$ resolution");
+
+                h.drDpt = bookHisto2D(basename + "_DrDpt",
+                        50, 0, 1, 50, -1, 1,
+                        "$\\Delta R$ vs $p_T$ resolution",
+                        "\\Delta R", "$p_T$ resolution", "entries");
+
+                return;
+            }
+
+
+            // the jet's label quantities are worked out once, then
+            // filled for every weight stream.
+            void fillLabelHistos(LabelConfig& cfg, unsigned int slot,
+                    const LabeledJet& labjet, const vector<double>& weights) {
+
+                double pt = labjet.pseudojet().pt();
+                int flavs[NLabelSchemes];
+                double dpts[NLabelSchemes];
+                double drs[NLabelSchemes];
+                for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++) {
+                    const Particle& labelpart = labjet[LabelScheme(ilab)];
+
+                    // labels outside the known flavour categories have
+                    // no histograms booked.
+                    flavs[ilab] = pidToFlavor(labelpart.pid());
+                    dpts[ilab] = 1 - labelpart.pt()/pt;
+                    drs[ilab] = labjet.labelDr(LabelScheme(ilab));
+                }
+
+                for (unsigned int istream = 0; istream < weights.size(); istream++) {
+                    const double weight = weights[istream];
+
+                    for (unsigned int ilab = 0; ilab < NLabelSchemes; ilab++) {
+                        const int flav = flavs[ilab];
+                        if (flav < 0)
+                            continue;
+
+                        const double dpt = dpts[ilab];
+                        const double dr = drs[ilab];
+
+                        LabelHistos& h =
+                            cfg.labelHistoTable[labelHistoIndex(istream, slot, flav, ilab)];
+                        if (!h.pt)
+                            bookLabelHistos(h, labelHistoName(cfg, istream, slot, flav, ilab));
+
+                        h.pt->fill(pt, weight);
+                        h.dpt->fill(dpt, weight);
+                        h.dr->fill(dr, weight);
+                        h.meanDrVsPt->fill(pt, dr, weight);
+                        h.meanDptVsDr->fill(dr, dpt, weight);
+                        h.meanDptVsPt->fill(pt, dpt, weight);
+                        h.drDpt->fill(dr, dpt, weight);
+                    }
+
+                    unsigned int icomp = 0;
+                    for (unsigned int i = 0; i < NLabelSchemes; i++) {
+                        for (unsigned int j = i+1; j < NLabelSchemes; j++) {
+                            const unsigned int index = labelComparisonIndex(istream, slot, icomp++);
+                            if (flavs[i] < 0 || flavs[j] < 0)
+                                continue;
+
+                            Histo2DPtr& matrix = cfg.labelComparisonTable[index];
+                            if (!matrix)
+                                matrix = bookLabelComparison(cfg, istream, slot, i, j);
+
+                            // bin centres are the flavour indices.
+                            matrix->fill(
+                                    flavs[i] + 0.5, flavs[j] + 0.5, weight);
+                        }
+                    }
+                }
+            }
+
+            Histo2DPtr bookLabelComparison(const LabelConfig& cfg, unsigned int stream,
+                    unsigned int slot, unsigned int lab1, unsigned int lab2) {
+                return bookLabelComparison(streamPrefixes[stream] + cfg.prefix + leadlabs[slot],
+                        labels[lab1], labelsTex[lab1], labels[lab2], labelsTex[lab2]);
+            }
+
+
+            // flavour migration matrix between two label schemes, one
+            // bin per LabelFlavor, with the flavours as tick labels.
+            Histo2DPtr bookLabelComparison(const string& prefix,
+                    const string& lab1, const string& axis1,
+                    const string& lab2, const string& axis2) {
+
+                Histo2DPtr h = bookHisto2D(prefix + "_" + lab1 + "LabVs" + lab2 + "Lab",
+                        NLabelFlavors, 0, NLabelFlavors, NLabelFlavors, 0, NLabelFlavors,
+                        axis1 + " vs " + axis2,
+                        axis1, axis2, "fraction of jets");
+
+                string ticks;
+                for (unsigned int iflav = 0; iflav < NLabelFlavors; iflav++) {
+                    char centre[16];
+                    snprintf(centre, sizeof(centre), "%.2f", iflav + 0.5);
+                    ticks += (iflav ? "\t" : "") + string(centre) + "\t" + flavorsTex[iflav];
+                }
+
+                h->setAnnotation("XCustomMajorTicks", ticks);
+                h->setAnnotation("YCustomMajorTicks", ticks);
+                h->setAnnotation("PlotTickLabels", "1");
+                h->setAnnotation("PlotXMajorTicks", "0");
+
+                return h;
+            }
+
+
+            static unsigned int labelHistoIndex(unsigned int stream, unsigned int slot,
+                    unsigned int flav, unsigned int lab) {
+                return ((stream*NJetSlots + slot)*NLabelFlavors + flav)*NLabelSchemes + lab;
+            }
+
+            static unsigned int nLabelComparisons() {
+                return NLabelSchemes*(NLabelSchemes-1)/2;
+            }
+
+            static unsigned int labelComparisonIndex(unsigned int stream, unsigned int slot,
+                    unsigned int icomp) {
+                return (stream*NJetSlots + slot)*nLabelComparisons() + icomp;
+            }
+
+            // fills in the labels for a given jet
+            // rs is scratch space for the reclustering; it must not be
+            // shared between threads.
+            void fillJetLabels(LabeledJet& labjet, const LabelConfig& cfg,
+                    const EventWorkspace& ws, ReclusterScratch& rs) const {
+                MSG_DEBUG("fillng jet labels.");
+
+                rs.clear();
+
+                const FourMomentum& jp4 = labjet.momentum();
+
+                GhostCandidates& ghosts = rs.ghosts;
+                ghosts.gather(labjet.pseudojet());
+                ghosts.computeDr(jp4);
+
+                // save ghost-associated final partons for reclustering
+                ghosts.inputs(UserInfoParticle::GAFinalParton, rs.partons);
+
+                // best-matched parton label jets. the group's
+                // clusterings keep parton jets down to the loosest cut
+                // of its configurations.
+                static const UserInfoParticle::Tag partonJetTags[NPartonJetSchemes] = {
+                    UserInfoParticle::GAAktPartonJet,
+                    UserInfoParticle::GAKtPartonJet,
+                    UserInfoParticle::GACAPartonJet
+                };
+
+                for (unsigned int lab = 0; lab < NPartonJetSchemes; lab++) {
+                    const int i = ghosts.nearest(partonJetTags[lab],
+                            cfg.partonJetPtMin, cfg.maxLabelDr);
+                    if (i < 0)
+                        continue;
+
+                    const LabelScheme scheme = LabelScheme(lab);
+                    if (!labjet.isLabeled(scheme) || ghosts.dr(i) < labjet.labelDr(scheme)) {
+                        MSG_DEBUG("giving jet " << labels[lab] << " label.");
+                        labjet.setLabel(scheme, ghosts.info(i).particle(), ghosts.dr(i));
+                    }
+                }
+
+                // highest-pt ghost-associated parton
+                const int iMaxPt = ghosts.hardest(UserInfoParticle::GAParton);
+                if (iMaxPt >= 0) {
+                    MSG_DEBUG("giving jet MaxPt label");
+                    labjet.setLabel(MaxPtLabel, ghosts.info(iMaxPt).particle(), ghosts.dr(iMaxPt));
                 }
 
                 // recluster ghost-matched partons
-                ClusterSequence qcdawarereclusterktcs(partonReclusteredInputs, qcdawarekt);
+                fillReclusteredLabel(labjet, jp4, cfg, ws, rs);
+
+                return;
+            }
+
+
+            // The Reclustered label: QCD-aware kt reclustering of the
+            // jet's ghost-associated final partons. The full-event kt
+            // clustering often makes this unnecessary: kt merges are
+            // pairwise and always the globally closest pair, so if the
+            // jet's partons are exactly the constituents of some final
+            // kt parton jets, reclustering them alone repeats the same
+            // merges and gives those same jets.
+            void fillReclusteredLabel(LabeledJet& labjet, const FourMomentum& jp4,
+                    const LabelConfig& cfg, const EventWorkspace& ws,
+                    ReclusterScratch& rs) const {
+
+                const double ptmin = cfg.partonJetPtMin;
+
+                if (rs.partons.empty())
+                    return;
+
+                // a single parton is its own jet.
+                if (rs.partons.size() == 1) {
+                    const PseudoJet& pj = ws.partonPJs[rs.partons[0]];
+                    if (pj.perp2() >= ptmin*ptmin)
+                        labjet.setLabel(ReclusteredLabel, Particle(pj.user_index(), momentum(pj)),
+                                deltaR(jp4, momentum(pj)));
+                    return;
+                }
+
+                // which final kt jets do the jet's partons come from?
+                // there are few of them, so a linear search will do.
+                unsigned int nTouchedPartons = 0;
+                foreach (int iParton, rs.partons) {
+                    const int iKt = ws.ktJetOfParton[iParton];
+                    if (std::find(rs.ktJetsTouched.begin(), rs.ktJetsTouched.end(), iKt)
+                            != rs.ktJetsTouched.end())
+                        continue;
+
+                    rs.ktJetsTouched.push_back(iKt);
+                    nTouchedPartons += ws.ktFinalJetSizes[iKt];
+                }
+
+                if (nTouchedPartons == rs.partons.size()) {
+                    // same order as sorted_by_pt, so ties in dR go the
+                    // same way as after a reclustering.
+                    const vector<PseudoJet>& ktJets = ws.ktFinalJets;
+                    std::sort(rs.ktJetsTouched.begin(), rs.ktJetsTouched.end(),
+                            [&ktJets] (int a, int b) {
+                                return ktJets[a].perp2() > ktJets[b].perp2(); });
+
+                    foreach (int iKt, rs.ktJetsTouched) {
+                        const PseudoJet& pj = ws.ktFinalJets[iKt];
+                        if (pj.perp2() < ptmin*ptmin)
+                            continue;
+
+                        const FourMomentum p4 = momentum(pj);
+                        const double dr = deltaR(jp4, p4);
+                        if (!labjet.isLabeled(ReclusteredLabel) || dr < labjet.labelDr(ReclusteredLabel))
+                            labjet.setLabel(ReclusteredLabel, Particle(pj.user_index(), p4), dr);
+                    }
+
+                    return;
+                }
+
+                // no luck: recluster them, in the order they came.
+                foreach (int iParton, rs.partons)
+                    rs.inputs.push_back(ws.partonPJs[iParton]);
+
+                ClusterSequence qcdawarereclusterktcs(rs.inputs, groups[cfg.group].qcdawarekt);
                 const vector<PseudoJet> reclusterKtPartonJets =
-                    sorted_by_pt(qcdawarereclusterktcs.inclusive_jets(5*GeV));
+                    sorted_by_pt(qcdawarereclusterktcs.inclusive_jets(ptmin));
 
                 foreach (const PseudoJet& pj, reclusterKtPartonJets) {
-                    if (!labjet["Reclustered"].pt() ||
-                            deltaR(jp4, momentum(pj)) < deltaR(jp4, labjet["Reclustered"]))
-                        labjet["Reclustered"] = Particle(pj.user_index(), momentum(pj));
+                    const FourMomentum p4 = momentum(pj);
+                    const double dr = deltaR(jp4, p4);
+                    if (!labjet.isLabeled(ReclusteredLabel) || dr < labjet.labelDr(ReclusteredLabel))
+                        labjet.setLabel(ReclusteredLabel, Particle(pj.user_index(), p4), dr);
                 }
 
                 return;
             }
 
 
-            string pidToLabel(int pid) {
+            // sorted QCD-aware parton jets above ptmin.
+            static void clusterPartonJets(const vector<PseudoJet>& partonPJs,
+                    const QCDAwarePlugin* plugin, double ptmin, vector<PseudoJet>& jets) {
+                ClusterSequence cs(partonPJs, plugin);
+                jets = sorted_by_pt(cs.inclusive_jets(ptmin));
+            }
+
+
+            // string option from the environment, or def if unset.
+            static string envString(const char* name, const string& def) {
+                const char* val = getenv(name);
+                return val ? string(val) : def;
+            }
+
+
+            // as clusterPartonJets(), also recording the final jets and
+            // which one each input ended up in.
+            static void clusterKtPartonJets(const vector<PseudoJet>& partonPJs,
+                    const QCDAwarePlugin* plugin, double ptmin, vector<PseudoJet>& jets,
+                    EventWorkspace& ws) {
+                ClusterSequence cs(partonPJs, plugin);
+                jets = sorted_by_pt(cs.inclusive_jets(ptmin));
+
+                // initial particles are the first entries of the
+                // clustering history, in input order.
+                ws.ktFinalJets = cs.inclusive_jets();
+                ws.ktFinalJetSizes.resize(ws.ktFinalJets.size());
+                ws.ktJetOfParton.assign(partonPJs.size(), -1);
+                for (unsigned int iKt = 0; iKt < ws.ktFinalJets.size(); iKt++) {
+                    const vector<PseudoJet> consts = cs.constituents(ws.ktFinalJets[iKt]);
+                    ws.ktFinalJetSizes[iKt] = consts.size();
+                    foreach (const PseudoJet& c, consts)
+                        ws.ktJetOfParton[c.cluster_hist_index()] = iKt;
+                }
+            }
+
+
+            // integer option from the environment, or def if unset.
+            static int envOption(const char* name, int def) {
+                const char* val = getenv(name);
+                return val ? atoi(val) : def;
+            }
+
+
+            // returns the LabelFlavor of a label pid, or -1 if it
+            // falls outside the booked categories.
+            static int pidToFlavor(int pid) {
 
                 int abspid = abs(pid);
                 switch (abspid) {
                     case 22:
-                        return "Photon";
+                        return PhotonFlavor;
                     case 21:
-                        return "Gluon";
+                        return GluonFlavor;
                     case 15:
-                        return "Tau";
+                        return TauFlavor;
                     case 13:
-                        return "Muon";
+                        return MuonFlavor;
                     case 11:
-                        return "Electron";
+                        return ElectronFlavor;
                     case 5:
-                        return "Bottom";
+                        return BottomFlavor;
                     case 4:
-                        return "Charm";
+                        return CharmFlavor;
                     case 3:
                     case 2:
                     case 1:
-                        return "Light";
+                        return LightFlavor;
                     case 0:
-                        return "Unlabeled";
+                        return UnlabeledFlavor;
                 }
 
-                return "";
+                return -1;
             }
 
 
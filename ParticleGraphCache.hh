@@ -0,0 +1,184 @@
+#ifndef QCDAWARE_PARTICLEGRAPHCACHE_HH
+#define QCDAWARE_PARTICLEGRAPHCACHE_HH
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "Rivet/Particle.hh"
+#include "Rivet/Tools/RivetHepMC.hh"
+
+namespace Rivet {
+
+    // Per-event cache of the GenEvent decay graph.
+    //
+    // Particle::fromDecay() and Particle::stableDescendants() walk the
+    // HepMC record from scratch on every call; this answers the same
+    // questions with every vertex visited at most once per event for
+    // ancestry and once per queried particle for descendants. Call
+    // build() at the start of every event; the containers keep their
+    // capacity between events, so that after the first few events
+    // nothing here allocates.
+    class ParticleGraphCache {
+        private:
+            typedef std::pair<const GenParticle*, unsigned int> IndexEntry;
+
+            std::vector<const GenParticle*> _particles;
+
+            // (particle, its place in _particles), sorted by pointer.
+            std::vector<IndexEntry> _index;
+
+            // per particle: 0 = not known yet, 1 = working on it,
+            // 2 = not from a decay, 3 = from a decay.
+            std::vector<unsigned char> _fromDecay;
+
+            // per particle, valid where _haveDescendants is set; the
+            // ones set this event are listed in _described.
+            std::vector<Particles> _stableDescendants;
+            std::vector<unsigned char> _haveDescendants;
+            std::vector<unsigned int> _described;
+
+            // descendants of particles that aren't in the record
+            Particles _uncached;
+
+            // scratch for descendant walks; decay trees are small
+            // enough to search the visited vertices linearly.
+            std::vector<const GenVertex*> _stack;
+            std::vector<const GenVertex*> _visited;
+
+            int index(const GenParticle* gp) const {
+                std::vector<IndexEntry>::const_iterator it =
+                    std::lower_bound(_index.begin(), _index.end(), IndexEntry(gp, 0));
+                return it != _index.end() && it->first == gp ? int(it->second) : -1;
+            }
+
+            // a decayed hadron or tau: what Particle::fromDecay()
+            // looks for among the ancestors.
+            static bool isDecayedHadronOrTau(const GenParticle* gp) {
+                const int pid = gp->pdg_id();
+                return gp->status() == 2 &&
+                    (PID::isHadron(pid) || abs(pid) == PID::TAU);
+            }
+
+            bool fromDecay(unsigned int i) {
+                if (_fromDecay[i] == 1)
+                    return false; // a loop in the record
+                if (_fromDecay[i] > 1)
+                    return _fromDecay[i] == 3;
+
+                _fromDecay[i] = 1;
+
+                bool result = false;
+                const GenVertex* prodVtx = _particles[i]->production_vertex();
+                if (prodVtx) {
+                    for (GenVertex::particles_in_const_iterator it = prodVtx->particles_in_const_begin();
+                            it != prodVtx->particles_in_const_end(); ++it) {
+
+                        if (isDecayedHadronOrTau(*it)) {
+                            result = true;
+                            break;
+                        }
+
+                        const int iAnc = index(*it);
+                        if (iAnc >= 0 && fromDecay(iAnc)) {
+                            result = true;
+                            break;
+                        }
+                    }
+                }
+
+                _fromDecay[i] = result ? 3 : 2;
+                return result;
+            }
+
+        public:
+            void build(const GenEvent* ge) {
+                _particles.clear();
+                _index.clear();
+
+                for (GenEvent::particle_const_iterator it = ge->particles_begin();
+                        it != ge->particles_end(); ++it) {
+                    _index.push_back(IndexEntry(*it, _particles.size()));
+                    _particles.push_back(*it);
+                }
+
+                std::sort(_index.begin(), _index.end());
+
+                const unsigned int n = _particles.size();
+                _fromDecay.assign(n, 0);
+
+                // clear only what was filled, keeping the capacity.
+                for (unsigned int j = 0; j < _described.size(); j++)
+                    _stableDescendants[_described[j]].clear();
+                _described.clear();
+                if (_stableDescendants.size() < n)
+                    _stableDescendants.resize(n);
+                _haveDescendants.assign(n, 0);
+            }
+
+            // every particle in the event, in record order.
+            const std::vector<const GenParticle*>& particles() const {
+                return _particles;
+            }
+
+            // true if any ancestor is a decayed hadron or tau.
+            bool fromDecay(const Particle& p) {
+                const int i = p.genParticle() ? index(p.genParticle()) : -1;
+                return i >= 0 ? fromDecay(i) : p.fromDecay();
+            }
+
+            // stable (status 1, undecayed) descendants.
+            const Particles& stableDescendants(const Particle& p) {
+                const int i = p.genParticle() ? index(p.genParticle()) : -1;
+                if (i < 0) {
+                    // not in this event's record; cache nothing.
+                    _uncached = p.stableDescendants();
+                    return _uncached;
+                }
+
+                Particles& rtn = _stableDescendants[i];
+                if (_haveDescendants[i])
+                    return rtn;
+
+                _haveDescendants[i] = 1;
+                _described.push_back(i);
+
+                _stack.clear();
+                _visited.clear();
+                if (_particles[i]->end_vertex())
+                    _stack.push_back(_particles[i]->end_vertex());
+
+                while (!_stack.empty()) {
+                    const GenVertex* v = _stack.back();
+                    _stack.pop_back();
+                    if (std::find(_visited.begin(), _visited.end(), v) != _visited.end())
+                        continue;
+                    _visited.push_back(v);
+
+                    for (GenVertex::particles_out_const_iterator it = v->particles_out_const_begin();
+                            it != v->particles_out_const_end(); ++it) {
+                        const GenParticle* gp = *it;
+                        if (gp->end_vertex())
+                            _stack.push_back(gp->end_vertex());
+                        else if (gp->status() == 1)
+                            rtn.push_back(Particle(gp));
+                    }
+                }
+
+                return rtn;
+            }
+
+            // a tau with a hadron among its stable descendants.
+            bool isHadronicTau(const Particle& tau) {
+                const Particles& descendants = stableDescendants(tau);
+                for (unsigned int i = 0; i < descendants.size(); i++)
+                    if (descendants[i].isHadron())
+                        return true;
+
+                return false;
+            }
+    };
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+// -*- C++ -*-
+// Replays a HepMC file through MC_QCDAWARE_JETS and reports throughput.
+//
+//   qcdaware-bench events.hepmc|events.skim [passes] [output.yoda]
+//   qcdaware-bench --synthetic nevents [passes] [output.yoda]
+//
+// The whole file is read into memory first, so the timing covers the
+// analysis alone. Set QCDAWARE_TIMING=0 to skip the analysis's own
+// per-stage breakdown.
+//
+// A skim written with QCDAWARE_SKIM is replayed instead: the analysis
+// reads the inputs from it, and the driver only feeds it empty events
+// carrying each record's weight and cross section.
+//
+// --synthetic makes nevents deterministic toy events (SyntheticEvents.hh)
+// instead, with QCDAWARE_SYNTH_PARTONS, _FLAVOURS (comma-separated PDG
+// IDs), _LEPTONS, _HADTAUS, _LEPTAUS, _SOFT and _SEED setting what goes
+// in them. Their output is the same from run to run, so the output of
+// a change can be compared with that of the code before it.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HepMC/GenEvent.h"
+#include "HepMC/IO_GenEvent.h"
+
+#include "Rivet/AnalysisHandler.hh"
+
+#include "AllocCounter.hh"
+#include "SkimFile.hh"
+#include "SyntheticEvents.hh"
+
+using namespace std;
+
+
+// one event per skim record, with its weight and cross section and
+// nothing but two 6.5 TeV beam protons, which Rivet needs to find the
+// beams; the analysis takes everything else from the skim.
+static void readSkimEvents(const string& fname, vector<HepMC::GenEvent*>& events) {
+    const double ebeam = 6500;
+
+    QCDAwareSkim::Reader skim(fname);
+    QCDAwareSkim::Record record;
+    while (skim.next(record) && skim.skipParticles()) {
+        HepMC::GenEvent* ge = new HepMC::GenEvent();
+        ge->use_units(HepMC::Units::GEV, HepMC::Units::MM);
+        ge->weights().push_back(record.weight);
+
+        HepMC::GenVertex* v = new HepMC::GenVertex();
+        ge->add_vertex(v);
+        HepMC::GenParticle* beam1 =
+            new HepMC::GenParticle(HepMC::FourVector(0, 0, ebeam, ebeam), 2212, 4);
+        HepMC::GenParticle* beam2 =
+            new HepMC::GenParticle(HepMC::FourVector(0, 0, -ebeam, ebeam), 2212, 4);
+        v->add_particle_in(beam1);
+        v->add_particle_in(beam2);
+        ge->set_beam_particles(beam1, beam2);
+
+#ifdef HEPMC_HAS_CROSS_SECTION
+        if (record.crossSection > 0) {
+            HepMC::GenCrossSection xs;
+            xs.set_cross_section(record.crossSection, record.crossSectionError);
+            ge->set_cross_section(xs);
+        }
+#endif
+        events.push_back(ge);
+    }
+}
+
+
+static unsigned int envCount(const char* name, unsigned int def) {
+    const char* value = getenv(name);
+    return value ? atoi(value) : def;
+}
+
+
+static void makeSyntheticEvents(unsigned int n, vector<HepMC::GenEvent*>& events) {
+    SyntheticEvents synth(envCount("QCDAWARE_SYNTH_SEED", 1));
+    synth.nPartons = envCount("QCDAWARE_SYNTH_PARTONS", synth.nPartons);
+    synth.nLeptons = envCount("QCDAWARE_SYNTH_LEPTONS", synth.nLeptons);
+    synth.nHadronicTaus = envCount("QCDAWARE_SYNTH_HADTAUS", synth.nHadronicTaus);
+    synth.nLeptonicTaus = envCount("QCDAWARE_SYNTH_LEPTAUS", synth.nLeptonicTaus);
+    synth.nSoft = envCount("QCDAWARE_SYNTH_SOFT", synth.nSoft);
+
+    if (const char* flavours = getenv("QCDAWARE_SYNTH_FLAVOURS")) {
+        synth.flavours.clear();
+        istringstream ss(flavours);
+        string pid;
+        while (getline(ss, pid, ','))
+            if (!pid.empty())
+                synth.flavours.push_back(atoi(pid.c_str()));
+    }
+
+    for (unsigned int i = 0; i < n; i++)
+        events.push_back(synth.next());
+}
+
+
+int main(int argc, char** argv) {
+
+    const string program = argv[0];
+    const bool synthetic = argc > 1 && string(argv[1]) == "--synthetic";
+    if (synthetic) {
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2) {
+        cerr << "usage: " << program << " events.hepmc|events.skim [passes] [output.yoda]" << endl
+            << "       " << program << " --synthetic nevents [passes] [output.yoda]" << endl;
+        return 1;
+    }
+
+    const string hepmcFile = argv[1];
+    const int nPasses = argc > 2 ? atoi(argv[2]) : 1;
+    const string yodaFile = argc > 3 ? argv[3] : "";
+
+    // find the plugin next to the driver unless told otherwise, and
+    // have the analysis time its stages.
+    setenv("RIVET_ANALYSIS_PATH", ".", 0);
+    setenv("QCDAWARE_TIMING", "1", 0);
+
+    const QCDAwareSkim::Reader skim(hepmcFile);
+
+    vector<HepMC::GenEvent*> events;
+    if (synthetic) {
+        makeSyntheticEvents(atoi(hepmcFile.c_str()), events);
+    } else if (skim.isSkim() && !skim.good()) {
+        cerr << hepmcFile << " is a skim of another version" << endl;
+        return 1;
+    } else if (skim.good()) {
+        setenv("QCDAWARE_SKIM_REPLAY", hepmcFile.c_str(), 1);
+        readSkimEvents(hepmcFile, events);
+    } else {
+        HepMC::IO_GenEvent input(hepmcFile, ios::in);
+        while (HepMC::GenEvent* ge = input.read_next_event())
+            events.push_back(ge);
+    }
+
+    if (events.empty()) {
+        cerr << "no events in " << hepmcFile << endl;
+        return 1;
+    }
+
+    if (synthetic)
+        cout << "made " << events.size() << " synthetic events" << endl;
+    else
+        cout << "read " << events.size() << " events from " << hepmcFile << endl;
+
+    Rivet::AnalysisHandler handler;
+    handler.addAnalysis("MC_QCDAWARE_JETS");
+    handler.init(*events[0]);
+
+    const unsigned long allocs0 = AllocCounter::allocations;
+    const unsigned long bytes0 = AllocCounter::bytes;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    int eventNumber = 0;
+    for (int iPass = 0; iPass < nPasses; iPass++) {
+        for (unsigned int i = 0; i < events.size(); i++) {
+            // every replayed event is a new event as far as Rivet is
+            // concerned.
+            events[i]->set_event_number(++eventNumber);
+            handler.analyze(*events[i]);
+        }
+    }
+
+    // finalize() waits for any events still being labelled on
+    // QCDAWARE_EVENT_THREADS, so it counts too.
+    handler.finalize();
+
+    const double seconds = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+    const unsigned long allocs = AllocCounter::allocations - allocs0;
+    const unsigned long bytes = AllocCounter::bytes - bytes0;
+
+    if (!yodaFile.empty())
+        handler.writeData(yodaFile);
+
+    printf("%d events in %.3f s: %.1f events/s\n",
+            eventNumber, seconds, eventNumber/seconds);
+    printf("%.1f allocations, %.1f kB allocated per event\n",
+            double(allocs)/eventNumber, bytes/1024./eventNumber);
+
+    for (unsigned int i = 0; i < events.size(); i++)
+        delete events[i];
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+#ifndef QCDAWARE_SKIMFILE_HH
+#define QCDAWARE_SKIMFILE_HH
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Rivet/Particle.hh"
+
+// A stream of the per-event inputs MC_QCDAWARE_JETS labels jets from,
+// so that the labelling can be rerun without reading HepMC or running
+// the projections again.
+//
+// Layout, in the byte order of the writing machine:
+//
+//   header, 16 bytes:
+//     char[8] "QCDSKIM1", uint32 version, uint32 reserved.
+//
+//   then one record per event:
+//     double weight, double cross section, double cross section error,
+//     uint32 number of parton-jet inputs, visible particles (the
+//     event's own, without any pile-up overlay) and generator partons
+//     and photons, uint32 reserved,
+//     then that many particles, in the same order:
+//       int32 pid, double px, py, pz, e
+namespace QCDAwareSkim {
+
+    const unsigned int headerSize = 16;
+    const unsigned int recordHeaderSize = 40;
+    const unsigned int particleSize = 36;
+    const uint32_t version = 1;
+    const unsigned int nLists = 3;
+
+    struct Record {
+        double weight;
+        double crossSection;
+        double crossSectionError;
+        uint32_t sizes[nLists];
+    };
+
+
+    class Writer {
+        private:
+            std::ofstream _out;
+            std::vector<char> _buffer;
+
+            void addParticles(const std::vector<Rivet::Particle>& particles, size_t n) {
+                for (unsigned int i = 0; i < n; i++) {
+                    const Rivet::Particle& p = particles[i];
+                    const int32_t pid = p.pid();
+                    const double mom[4] = { p.px(), p.py(), p.pz(), p.E() };
+
+                    const size_t n = _buffer.size();
+                    _buffer.resize(n + particleSize);
+                    memcpy(&_buffer[n], &pid, sizeof(pid));
+                    memcpy(&_buffer[n + sizeof(pid)], mom, sizeof(mom));
+                }
+            }
+
+            // keep the first nEvents records that an earlier run wrote
+            // to path, and append after them. Leaves the file alone,
+            // and the writer closed, if it has a different header or
+            // fewer records.
+            void reopen(const std::string& path, const char* header, unsigned long nEvents) {
+                std::ifstream in(path.c_str(), std::ios::binary);
+                char saved[headerSize];
+                if (!in.read(saved, headerSize) || memcmp(saved, header, headerSize))
+                    return;
+
+                in.seekg(0, std::ios::end);
+                const uint64_t size = in.tellg();
+
+                uint64_t keep = headerSize;
+                for (unsigned long i = 0; i < nEvents; i++) {
+                    char record[recordHeaderSize];
+                    uint32_t sizes[nLists];
+                    in.seekg(keep);
+                    if (!in.read(record, recordHeaderSize))
+                        return;
+
+                    memcpy(sizes, record + 3*sizeof(double), sizeof(sizes));
+                    keep += recordHeaderSize
+                        + (uint64_t(sizes[0]) + sizes[1] + sizes[2])*particleSize;
+                    if (keep > size)
+                        return;
+                }
+
+                in.close();
+                if (truncate(path.c_str(), keep) != 0)
+                    return;
+
+                _out.open(path.c_str(), std::ios::binary | std::ios::app);
+            }
+
+        public:
+            // with resumeEvents, keep the first resumeEvents records
+            // already in path, as reopen() does, instead of starting
+            // the file again.
+            Writer(const std::string& path, unsigned long resumeEvents=0) {
+                char header[headerSize];
+                memset(header, 0, headerSize);
+                memcpy(header, "QCDSKIM1", 8);
+                memcpy(header + 8, &version, sizeof(version));
+
+                if (resumeEvents) {
+                    reopen(path, header, resumeEvents);
+                    return;
+                }
+
+                _out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+                _out.write(header, headerSize);
+            }
+
+            bool good() const {
+                return _out.is_open() && _out.good();
+            }
+
+            // only the first nVisible visibleParticles are written,
+            // e.g. to leave out a pile-up overlay.
+            void write(double weight, double crossSection, double crossSectionError,
+                    const std::vector<Rivet::Particle>& partonJetInputs,
+                    const std::vector<Rivet::Particle>& visibleParticles,
+                    const std::vector<Rivet::Particle>& genPartons,
+                    size_t nVisible=size_t(-1)) {
+
+                nVisible = std::min(nVisible, visibleParticles.size());
+
+                _buffer.assign(recordHeaderSize, 0);
+                const double values[3] = { weight, crossSection, crossSectionError };
+                const uint32_t sizes[nLists] = { uint32_t(partonJetInputs.size()),
+                    uint32_t(nVisible), uint32_t(genPartons.size()) };
+                memcpy(&_buffer[0], values, sizeof(values));
+                memcpy(&_buffer[sizeof(values)], sizes, sizeof(sizes));
+
+                addParticles(partonJetInputs, partonJetInputs.size());
+                addParticles(visibleParticles, nVisible);
+                addParticles(genPartons, genPartons.size());
+
+                _out.write(&_buffer[0], _buffer.size());
+            }
+
+            // write out the records so far, e.g. at a checkpoint.
+            void flush() {
+                _out.flush();
+            }
+
+            void close() {
+                if (_out.is_open())
+                    _out.close();
+            }
+    };
+
+
+    class Reader {
+        private:
+            std::ifstream _in;
+            std::vector<char> _buffer;
+            Record _record;
+            bool _skim;
+            bool _good;
+
+            void readParticles(unsigned int n, size_t offset,
+                    std::vector<Rivet::Particle>& particles) const {
+                particles.clear();
+                for (unsigned int i = 0; i < n; i++) {
+                    const char* p = &_buffer[offset + i*particleSize];
+                    int32_t pid;
+                    double mom[4];
+                    memcpy(&pid, p, sizeof(pid));
+                    memcpy(mom, p + sizeof(pid), sizeof(mom));
+
+                    particles.push_back(Rivet::Particle(pid,
+                                Rivet::FourMomentum(mom[3], mom[0], mom[1], mom[2])));
+                }
+            }
+
+        public:
+            Reader(const std::string& path)
+                : _in(path.c_str(), std::ios::binary), _skim(false), _good(false) {
+
+                char header[headerSize];
+                if (!_in.read(header, headerSize) || memcmp(header, "QCDSKIM1", 8))
+                    return;
+
+                // a different layout would be misread.
+                uint32_t fileVersion;
+                memcpy(&fileVersion, header + 8, sizeof(fileVersion));
+                _skim = true;
+                _good = fileVersion == version;
+            }
+
+            // whether the file is a skim, of any version.
+            bool isSkim() const {
+                return _skim;
+            }
+
+            // whether the file opened and is a skim of this version.
+            bool good() const {
+                return _good;
+            }
+
+            // start again from the first event.
+            void rewind() {
+                _in.clear();
+                _in.seekg(headerSize);
+            }
+
+            // read the next event's record header; false at the end.
+            bool next(Record& record) {
+                char header[recordHeaderSize];
+                if (!_good || !_in.read(header, recordHeaderSize))
+                    return false;
+
+                memcpy(&record.weight, header, sizeof(double));
+                memcpy(&record.crossSection, header + sizeof(double), sizeof(double));
+                memcpy(&record.crossSectionError, header + 2*sizeof(double), sizeof(double));
+                memcpy(record.sizes, header + 3*sizeof(double), sizeof(record.sizes));
+
+                _record = record;
+                return true;
+            }
+
+            // the particles of the event just started with next().
+            bool readParticles(std::vector<Rivet::Particle>& partonJetInputs,
+                    std::vector<Rivet::Particle>& visibleParticles,
+                    std::vector<Rivet::Particle>& genPartons) {
+
+                const unsigned int n0 = _record.sizes[0];
+                const unsigned int n1 = _record.sizes[1];
+                const unsigned int n2 = _record.sizes[2];
+
+                // one spare byte, so that &_buffer[0] is fine for
+                // an empty event.
+                _buffer.resize(size_t(n0 + n1 + n2)*particleSize + 1);
+                if (!_in.read(&_buffer[0], size_t(n0 + n1 + n2)*particleSize))
+                    return false;
+
+                readParticles(n0, 0, partonJetInputs);
+                readParticles(n1, size_t(n0)*particleSize, visibleParticles);
+                readParticles(n2, size_t(n0 + n1)*particleSize, genPartons);
+
+                return true;
+            }
+
+            // skip the particles of the event just started with next().
+            bool skipParticles() {
+                const size_t n = size_t(_record.sizes[0]) + _record.sizes[1] + _record.sizes[2];
+                return bool(_in.seekg(n*particleSize, std::ios::cur));
+            }
+    };
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef QCDAWARE_STAGETIMER_HH
+#define QCDAWARE_STAGETIMER_HH
+
+#include <chrono>
+
+// Wall-clock time spent in each stage of the analysis.
+//
+// A StageTimer is only ever touched by one thread at a time; give each
+// workspace its own and add them up at the end.
+class StageTimer {
+    public:
+        enum Stage {
+            Projections = 0,
+            PartonClustering,
+            Ghosts,
+            ParticleClustering,
+            JetLabels,
+            Filling,
+            NStages
+        };
+
+        // times the enclosing block; does nothing for a NULL timer.
+        class Scope {
+            private:
+                StageTimer* _timer;
+                Stage _stage;
+                std::chrono::steady_clock::time_point _start;
+
+            public:
+                Scope(StageTimer* timer, Stage stage)
+                    : _timer(timer), _stage(stage) {
+                    if (_timer)
+                        _start = std::chrono::steady_clock::now();
+                }
+
+                ~Scope() {
+                    stop();
+                }
+
+                // end the stage before the end of the block.
+                void stop() {
+                    if (_timer)
+                        _timer->add(_stage, std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - _start).count());
+                    _timer = 0;
+                }
+        };
+
+    private:
+        double _seconds[NStages];
+        unsigned long _calls[NStages];
+
+    public:
+        StageTimer() {
+            for (unsigned int i = 0; i < NStages; i++) {
+                _seconds[i] = 0;
+                _calls[i] = 0;
+            }
+        }
+
+        void add(Stage stage, double seconds) {
+            _seconds[stage] += seconds;
+            _calls[stage]++;
+        }
+
+        double seconds(Stage stage) const {
+            return _seconds[stage];
+        }
+
+        unsigned long calls(Stage stage) const {
+            return _calls[stage];
+        }
+
+        StageTimer& operator+=(const StageTimer& other) {
+            for (unsigned int i = 0; i < NStages; i++) {
+                _seconds[i] += other._seconds[i];
+                _calls[i] += other._calls[i];
+            }
+
+            return *this;
+        }
+
+        static const char* name(Stage stage) {
+            switch (stage) {
+                case Projections:
+                    return "projections";
+                case PartonClustering:
+                    return "QCD-aware parton clustering";
+                case Ghosts:
+                    return "ghost construction";
+                case ParticleClustering:
+                    return "particle clustering";
+                case JetLabels:
+                    return "jet labels";
+                case Filling:
+                    return "histogram filling";
+                default:
+                    return "";
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef QCDAWARE_SYNTHETICEVENTS_HH
+#define QCDAWARE_SYNTHETICEVENTS_HH
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "HepMC/GenEvent.h"
+
+// Deterministic toy events for qcdaware-bench, so that the labelling
+// can be timed, and a change's output compared with the code's before
+// it, without a generator or a HepMC file.
+//
+// Each event has two beam protons and, out of one hard vertex:
+//   nPartons partons, their flavours cycled through flavours, each
+//     fragmenting into a narrow spray of stable hadrons and photons;
+//   nLeptons prompt electrons and muons, alternately;
+//   nHadronicTaus taus decaying to a pion and a neutrino;
+//   nLeptonicTaus taus decaying to an electron or muon and neutrinos;
+//   nSoft soft pions over |eta| < 5.
+//
+// The random numbers are std::mt19937's own output, which the standard
+// fixes, not the library's distributions, so a seed gives the same
+// numbers everywhere. The momenta made from them go through std::log,
+// sinh, cos and sin, which can differ in the last bit between libm
+// versions: compare labels and jet counts across platforms, as
+// `make check` does, not exact momenta or histogram contents.
+class SyntheticEvents {
+    public:
+        unsigned int nPartons;
+        unsigned int nLeptons;
+        unsigned int nHadronicTaus;
+        unsigned int nLeptonicTaus;
+        unsigned int nSoft;
+        std::vector<int> flavours;
+        double sqrtS;
+
+    private:
+        std::mt19937 _rng;
+        unsigned long _nEvents;
+
+        // in (0, 1)
+        double uniform() {
+            return (_rng() + 0.5)/4294967296.0;
+        }
+
+        double uniform(double lo, double hi) {
+            return lo + (hi - lo)*uniform();
+        }
+
+        double exponential(double mean) {
+            return -mean*std::log(uniform());
+        }
+
+        static HepMC::FourVector momentum(double pt, double eta, double phi, double m) {
+            const double px = pt*std::cos(phi);
+            const double py = pt*std::sin(phi);
+            const double pz = pt*std::sinh(eta);
+            return HepMC::FourVector(px, py, pz,
+                    std::sqrt(px*px + py*py + pz*pz + m*m));
+        }
+
+        // split a momentum among n collinear-ish daughters, spread
+        // by about width in eta and phi.
+        void spray(HepMC::GenVertex* v, double pt, double eta, double phi,
+                unsigned int n, double width) {
+
+            std::vector<double> z(n);
+            double sum = 0;
+            for (unsigned int i = 0; i < n; i++)
+                sum += z[i] = uniform();
+
+            for (unsigned int i = 0; i < n; i++) {
+                const double u = uniform();
+                int pid;
+                double m;
+                if (u < 0.35) {
+                    pid = 211;
+                    m = 0.1396;
+                } else if (u < 0.7) {
+                    pid = -211;
+                    m = 0.1396;
+                } else if (u < 0.9) {
+                    pid = 22;
+                    m = 0;
+                } else {
+                    pid = u < 0.95 ? 321 : -321;
+                    m = 0.4937;
+                }
+
+                v->add_particle_out(new HepMC::GenParticle(
+                            momentum(pt*z[i]/sum, eta + uniform(-width, width),
+                                phi + uniform(-width, width), m),
+                            pid, 1));
+            }
+        }
+
+        void addParton(HepMC::GenEvent* ge, HepMC::GenVertex* hard, unsigned int i) {
+            int pid = flavours.empty() ? 21 : flavours[i % flavours.size()];
+            if (pid != 21 && i % 2)
+                pid = -pid;
+
+            const double pt = 20 + exponential(40);
+            const double eta = uniform(-2.5, 2.5);
+            const double phi = uniform(0, 2*M_PI);
+
+            HepMC::GenParticle* parton =
+                new HepMC::GenParticle(momentum(pt, eta, phi, 0), pid, 2);
+            hard->add_particle_out(parton);
+
+            HepMC::GenVertex* hadronization = new HepMC::GenVertex();
+            ge->add_vertex(hadronization);
+            hadronization->add_particle_in(parton);
+            spray(hadronization, pt, eta, phi, 4 + unsigned(pt/5), 0.15);
+        }
+
+        void addTau(HepMC::GenEvent* ge, HepMC::GenVertex* hard, unsigned int i,
+                bool hadronic) {
+            const int sign = i % 2 ? -1 : 1;
+            const double pt = 20 + exponential(30);
+            const double eta = uniform(-2.5, 2.5);
+            const double phi = uniform(0, 2*M_PI);
+
+            HepMC::GenParticle* tau =
+                new HepMC::GenParticle(momentum(pt, eta, phi, 1.777), 15*sign, 2);
+            hard->add_particle_out(tau);
+
+            HepMC::GenVertex* decay = new HepMC::GenVertex();
+            ge->add_vertex(decay);
+            decay->add_particle_in(tau);
+
+            // the visible daughter takes a fraction z.
+            const double z = uniform(0.3, 0.9);
+            if (hadronic) {
+                decay->add_particle_out(new HepMC::GenParticle(
+                            momentum(z*pt, eta, phi, 0.1396), -211*sign, 1));
+            } else {
+                const int lepton = i % 4 < 2 ? 11 : 13;
+                decay->add_particle_out(new HepMC::GenParticle(
+                            momentum(z*pt, eta, phi, 0), lepton*sign, 1));
+                decay->add_particle_out(new HepMC::GenParticle(
+                            momentum(0.5*(1-z)*pt, eta, phi, 0), -(lepton+1)*sign, 1));
+            }
+
+            decay->add_particle_out(new HepMC::GenParticle(
+                        momentum((hadronic ? 1 : 0.5)*(1-z)*pt, eta, phi, 0), 16*sign, 1));
+        }
+
+    public:
+        SyntheticEvents(unsigned long seed=1)
+            : nPartons(4), nLeptons(1), nHadronicTaus(1), nLeptonicTaus(1),
+            nSoft(300), sqrtS(13000), _rng(seed), _nEvents(0) {
+
+            flavours.push_back(21);
+            flavours.push_back(1);
+            flavours.push_back(4);
+            flavours.push_back(5);
+        }
+
+        // a new event, owned by the caller.
+        HepMC::GenEvent* next() {
+            HepMC::GenEvent* ge = new HepMC::GenEvent();
+            ge->use_units(HepMC::Units::GEV, HepMC::Units::MM);
+            ge->set_event_number(++_nEvents);
+            ge->weights().push_back(1.0);
+#ifdef HEPMC_HAS_CROSS_SECTION
+            // 1 pb, so that the output is normalised to something.
+            HepMC::GenCrossSection xs;
+            xs.set_cross_section(1.0, 0.0);
+            ge->set_cross_section(xs);
+#endif
+
+            HepMC::GenVertex* hard = new HepMC::GenVertex();
+            ge->add_vertex(hard);
+
+            const double ebeam = sqrtS/2;
+            HepMC::GenParticle* beam1 =
+                new HepMC::GenParticle(HepMC::FourVector(0, 0, ebeam, ebeam), 2212, 4);
+            HepMC::GenParticle* beam2 =
+                new HepMC::GenParticle(HepMC::FourVector(0, 0, -ebeam, ebeam), 2212, 4);
+            hard->add_particle_in(beam1);
+            hard->add_particle_in(beam2);
+            ge->set_beam_particles(beam1, beam2);
+            ge->set_signal_process_vertex(hard);
+
+            for (unsigned int i = 0; i < nPartons; i++)
+                addParton(ge, hard, i);
+
+            for (unsigned int i = 0; i < nLeptons; i++) {
+                const int pid = i % 2 ? -13 : 11;
+                hard->add_particle_out(new HepMC::GenParticle(
+                            momentum(10 + exponential(20), uniform(-2.5, 2.5),
+                                uniform(0, 2*M_PI), 0), pid, 1));
+            }
+
+            for (unsigned int i = 0; i < nHadronicTaus; i++)
+                addTau(ge, hard, i, true);
+
+            for (unsigned int i = 0; i < nLeptonicTaus; i++)
+                addTau(ge, hard, i, false);
+
+            for (unsigned int i = 0; i < nSoft; i++)
+                hard->add_particle_out(new HepMC::GenParticle(
+                            momentum(exponential(0.5), uniform(-5, 5),
+                                uniform(0, 2*M_PI), 0.1396), i % 2 ? 211 : -211, 1));
+
+            return ge;
+        }
+};
+
+#endif
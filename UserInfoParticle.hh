@@ -1,37 +1,109 @@
-#include <string>
+#ifndef QCDAWARE_USERINFOPARTICLE_HH
+#define QCDAWARE_USERINFOPARTICLE_HH
+
+#include <vector>
 #include "fastjet/PseudoJet.hh"
 #include "Rivet/ParticleBase.hh"
 #include "Rivet/Particle.hh"
 
 class UserInfoParticle : public fastjet::PseudoJet::UserInfoBase {
+    public:
+        // what a clustering input represents.
+        enum Tag {
+            Untagged = 0,
+            VisibleParticle,
+            GAAktPartonJet,
+            GAKtPartonJet,
+            GACAPartonJet,
+            GAFinalParton,
+            GAParton
+        };
+
     private:
         // This doesn't store a reference because we want to be able
         // to cluster local variables!
         Rivet::Particle _p;
-        std::string _s;
+        Tag _t;
+        // index of the particle in whatever list it was taken
+        // from, if that matters.
+        int _input;
 
     public:
         UserInfoParticle()
-            : _p(), _s() { }
+            : _p(), _t(Untagged), _input(-1) { }
 
-        UserInfoParticle(const Rivet::Particle& p, const std::string& s="")
-            : _p(p), _s(s) { }
+        UserInfoParticle(const Rivet::Particle& p, Tag t=Untagged, int input=-1)
+            : _p(p), _t(t), _input(input) { }
 
         const Rivet::Particle& particle() const {
             return _p;
         }
 
-        const std::string& str() const {
-            return _s;
+        Tag tag() const {
+            return _t;
+        }
+
+        int input() const {
+            return _input;
+        }
+
+        void reset(const Rivet::Particle& p, Tag t, int input) {
+            _p = p;
+            _t = t;
+            _input = input;
+        }
+};
+
+
+// Event-scoped arena of UserInfoParticles.
+//
+// The pool holds one reference to each entry it has handed out; once
+// the PseudoJets and ClusterSequences of the previous event are gone
+// that is the only reference left and the entry is overwritten in
+// place, so a steady-state event allocates no user info at all.
+class UserInfoPool {
+    private:
+        typedef fastjet::SharedPtr<fastjet::PseudoJet::UserInfoBase> InfoPtr;
+
+        std::vector<InfoPtr> _infos;
+        size_t _used;
+
+    public:
+        UserInfoPool()
+            : _infos(), _used(0) { }
+
+        // hand every entry back to the pool.
+        // only call this once the previous event's PseudoJets are gone.
+        void reset() {
+            _used = 0;
+        }
+
+        const InfoPtr& get(const Rivet::Particle& p, UserInfoParticle::Tag t,
+                int input=-1) {
+            if (_used == _infos.size())
+                _infos.push_back(InfoPtr(new UserInfoParticle()));
+
+            // something still holds on to this entry from an earlier
+            // event: leave it alone and give it a fresh replacement.
+            else if (_infos[_used].use_count() > 1)
+                _infos[_used] = InfoPtr(new UserInfoParticle());
+
+            const InfoPtr& info = _infos[_used++];
+            static_cast<UserInfoParticle*>(info.get())->reset(p, t, input);
+
+            return info;
         }
 };
 
 
-fastjet::PseudoJet ghost(const Rivet::Particle &p, const std::string& s="", const int idx=-1) {
+inline fastjet::PseudoJet ghost(const Rivet::Particle &p, UserInfoPool& pool,
+        UserInfoParticle::Tag t, const int idx=-1, const int input=-1) {
     fastjet::PseudoJet pj;
     pj.reset_momentum(p.px()*1e-10, p.py()*1e-10, p.pz()*1e-10, p.E()*1e-10);
-    pj.set_user_info(new UserInfoParticle(p, s));
+    pj.set_user_info_shared_ptr(pool.get(p, t, input));
     pj.set_user_index(idx);
 
     return pj;
 }
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef QCDAWARE_WORKERPOOL_HH
+#define QCDAWARE_WORKERPOOL_HH
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small fixed-size thread pool.
+//
+// wait() blocks until every submitted task has finished; the waiting
+// thread runs queued tasks itself in the meantime, so a pool of N
+// threads works on N+1 tasks at once. The first exception thrown by a
+// task is rethrown from wait().
+class WorkerPool {
+    private:
+        std::vector<std::thread> _threads;
+        std::deque<std::function<void()> > _tasks;
+
+        std::mutex _mutex;
+        std::condition_variable _taskReady;
+        std::condition_variable _allDone;
+
+        unsigned int _pending;
+        bool _stop;
+        std::exception_ptr _error;
+
+        // run one task outside the lock; called with the lock held.
+        void runTask(std::unique_lock<std::mutex>& lock) {
+            std::function<void()> task = _tasks.front();
+            _tasks.pop_front();
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            if (error && !_error)
+                _error = error;
+
+            if (--_pending == 0)
+                _allDone.notify_all();
+        }
+
+        void work() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                while (!_stop && _tasks.empty())
+                    _taskReady.wait(lock);
+
+                if (_stop && _tasks.empty())
+                    return;
+
+                runTask(lock);
+            }
+        }
+
+    public:
+        explicit WorkerPool(unsigned int nthreads)
+            : _pending(0), _stop(false) {
+
+            for (unsigned int i = 0; i < nthreads; i++)
+                _threads.push_back(std::thread(&WorkerPool::work, this));
+        }
+
+        ~WorkerPool() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _taskReady.notify_all();
+
+            for (unsigned int i = 0; i < _threads.size(); i++)
+                _threads[i].join();
+        }
+
+        unsigned int size() const {
+            return _threads.size();
+        }
+
+        void submit(const std::function<void()>& task) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _tasks.push_back(task);
+                _pending++;
+            }
+            _taskReady.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_pending) {
+                if (!_tasks.empty())
+                    runTask(lock);
+                else
+                    _allDone.wait(lock);
+            }
+
+            if (_error) {
+                std::exception_ptr error = _error;
+                _error = std::exception_ptr();
+                std::rethrow_exception(error);
+            }
+        }
+};
+
+#endif
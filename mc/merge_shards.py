@@ -0,0 +1,84 @@
+from __future__ import print_function
+import yoda
+import optparse
+import re
+
+
+# written by the analysis in raw mode (QCDAWARE_RAW=1).
+ANALYSIS = "/MC_QCDAWARE_JETS/"
+SUMW = ANALYSIS + "RawSumOfWeights"
+XSEC = ANALYSIS + "RawCrossSection"
+
+# flavour migration matrices are normalised to unit sum, not to the
+# cross section.
+matrix = re.compile("LabVs[A-Za-z]+Lab$")
+
+# bookkeeping, never scaled.
+unscaled = re.compile("/Instrumentation_|_SumOfWeights$")
+
+# weight variations (QCDAWARE_WEIGHTS) are normalised to their own sum
+# of weights, kept in e.g. Weight3_SumOfWeights.
+stream = re.compile("^" + ANALYSIS + "(Weight[0-9]+_)")
+
+
+def main():
+    op = optparse.OptionParser(
+            usage="%prog merged.yoda shard.yoda [shard.yoda ...]")
+
+    opts, args = op.parse_args()
+
+    merged = {}
+    sumw = 0
+    xsecsumw = 0
+    for fname in args[1:]:
+        aos = yoda.read(fname)
+        if SUMW not in aos:
+            raise ValueError("%s was not written with QCDAWARE_RAW=1" % fname)
+
+        shardsumw = aos.pop(SUMW).sumW()
+        shardxsec = aos.pop(XSEC).sumW()
+
+        # each shard's cross section estimate, weighted by its share
+        # of the events.
+        sumw += shardsumw
+        xsecsumw += shardxsec*shardsumw
+
+        for path, ao in aos.items():
+            if path not in merged:
+                merged[path] = ao
+            elif hasattr(ao, "fill"):
+                merged[path] += ao
+
+            # anything else is run metadata; keep the first shard's.
+            continue
+
+    if sumw == 0:
+        raise ValueError("no events in %s" % " ".join(args[1:]))
+
+    xsec = xsecsumw/sumw
+    print("%d shards, sum of weights %g, cross section %g pb" %
+            (len(args)-1, sumw, xsec))
+
+    # as MC_QCDAWARE_JETS::finalize() does for a single run.
+    for path, ao in merged.items():
+        if not path.startswith(ANALYSIS) or unscaled.search(path):
+            continue
+
+        m = stream.match(path)
+        streamsumw = merged[ANALYSIS + m.group(1) + "SumOfWeights"].sumW() if m else sumw
+        norm = 1000*xsec/streamsumw if streamsumw != 0 else 0
+
+        if matrix.search(path):
+            if ao.sumW() != 0:
+                ao.normalize(1.0)
+        elif hasattr(ao, "scaleW"):
+            ao.scaleW(norm)
+
+        continue
+
+    yoda.write(list(merged.values()), args[0])
+
+    return 0
+
+if __name__ == '__main__':
+    main()
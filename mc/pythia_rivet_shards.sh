@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# usage: pythia_rivet_shards.sh card.cmnd NEVT [NSHARDS]
+#
+# as pythia_rivet_run.sh, but split over NSHARDS concurrent
+# generator+analysis pipelines, each with its own seed. The analysis
+# runs in raw mode and merge_shards.py combines and normalises the
+# shard outputs.
+
+CMNDFILE=$1
+YODAFILE=${1/cmnd/yoda}
+
+NEVT=$2
+NSHARDS=${3:-`nproc`}
+
+# seeds are SEED0, SEED0+1, ...
+SEED0=${SEED0:-1}
+
+export QCDAWARE_RAW=1
+
+SHARDYODAS=""
+for ((i = 0; i < NSHARDS; i++))
+do
+    SHARDCMND=${1/.cmnd/.shard$i.cmnd}
+    SHARDHEPMC=`mktemp`.hepmc
+    SHARDYODA=${SHARDCMND/cmnd/yoda}
+    PYTHIALOG=${SHARDCMND/cmnd/pythia.log}
+    RIVETLOG=${SHARDCMND/cmnd/rivet.log}
+
+    # spread the remainder over the first shards.
+    SHARDNEVT=$((NEVT / NSHARDS + (i < NEVT % NSHARDS)))
+
+    cp $CMNDFILE $SHARDCMND
+    echo "Random:setSeed = on" >> $SHARDCMND
+    echo "Random:seed = $((SEED0 + i))" >> $SHARDCMND
+
+    (
+        mkfifo $SHARDHEPMC
+
+        run-pythia -s -n $SHARDNEVT -e 13000 -i $SHARDCMND \
+            -o $SHARDHEPMC > $PYTHIALOG 2>&1 &
+
+        rivet --pwd -a MC_QCDAWARE_JETS $SHARDHEPMC \
+            -H $SHARDYODA > $RIVETLOG 2>&1
+
+        rm $SHARDHEPMC
+    ) &
+
+    SHARDYODAS="$SHARDYODAS $SHARDYODA"
+done
+
+wait
+
+python `dirname $0`/merge_shards.py $YODAFILE $SHARDYODAS